@@ -0,0 +1,160 @@
+#!/bin/sh
+#
+# bench.sh -- measure ioping own overhead: maximum request rate and
+# time per request against in-memory targets, for every engine and
+# output mode. Time per request is (time of N requests - time of one
+# request) / (N - 1), thus preparation and startup costs are excluded.
+#
+# Usage: bench.sh [ioping binary]
+#
+# Environment:
+#   BENCH_COUNT   requests per run (100000, at least 1000)
+#   BENCH_REPEAT  runs per case, best is reported (3)
+#   BENCH_OUTPUT  result file (ioping-bench.json)
+#
+
+IOPING=${1:-./ioping}
+COUNT=${BENCH_COUNT:-100000}
+REPEAT=${BENCH_REPEAT:-3}
+OUTPUT=${BENCH_OUTPUT:-ioping-bench.json}
+WSIZE=16m
+MIN_COUNT=1000
+
+# RWF_HIPRI is ignored for buffered I/O but switches to preadv2()
+ENGINES="pread: aio:-A preadv2:-H"
+MODES="quiet:-q text: json:-J"
+
+TMPDIR=$(mktemp -d "${TMPDIR:-/tmp}/ioping-bench.XXXXXX") || exit 2
+SHMDIR=
+LOOPDEV=
+
+cleanup() {
+	[ -n "$LOOPDEV" ] && losetup -d "$LOOPDEV"
+	[ -n "$SHMDIR" ] && rm -rf "$SHMDIR"
+	rm -rf "$TMPDIR"
+}
+trap cleanup EXIT
+trap 'exit 1' INT TERM
+
+now() {
+	date +%s%N
+}
+
+# run_ioping <target> <options...>
+run_ioping() {
+	target=$1
+	shift
+	case "$target" in
+	memfd)
+		python3 -c '
+import os, sys
+fd = os.memfd_create("ioping", 0)
+os.ftruncate(fd, 16 << 20)
+os.set_inheritable(fd, True)
+os.execv(sys.argv[1], sys.argv[1:] + ["/proc/self/fd/%d" % fd])
+' "$IOPING" "$@"
+		;;
+	*)
+		"$IOPING" "$@" "$target"
+		;;
+	esac
+}
+
+# elapsed <count> <target> <options...>
+elapsed() {
+	count=$1
+	shift
+	target=$1
+	shift
+	start=$(now)
+	run_ioping "$target" -C -i 0 -S $WSIZE -c "$count" "$@" \
+		>/dev/null 2>>"$TMPDIR/stderr" || return 1
+	echo $(( $(now) - start ))
+}
+
+# bench <name> <target> <engine> <mode> <options...>
+bench() {
+	name=$1 target=$2 engine=$3 mode=$4
+	shift 4
+	best=
+	i=0
+	while [ $i -lt "$REPEAT" ]; do
+		if ! one=$(elapsed 1 "$target" "$@") ||
+		   ! all=$(elapsed "$COUNT" "$target" "$@"); then
+			echo "skip $name $engine $mode: $(tail -n 1 "$TMPDIR/stderr")" >&2
+			return
+		fi
+		ns=$(( (all - one) / (COUNT - 1) ))
+		# startup jitter exceeds time of all requests
+		if [ "$ns" -le 0 ]; then
+			echo "invalid $name $engine $mode: run of $COUNT requests is not longer than one, raise BENCH_COUNT" >&2
+			[ -n "$RESULTS" ] && RESULTS="$RESULTS,"
+			RESULTS="$RESULTS
+    { \"target\": \"$name\", \"engine\": \"$engine\", \"output\": \"$mode\", \"requests\": $COUNT, \"ns_per_request\": null, \"iops\": null }"
+			return
+		fi
+		if [ -z "$best" ] || [ "$ns" -lt "$best" ]; then
+			best=$ns
+		fi
+		i=$((i + 1))
+	done
+	printf '%-8s %-8s %-6s %8d ns/request %10d iops\n' \
+		"$name" "$engine" "$mode" "$best" $((1000000000 / best))
+	[ -n "$RESULTS" ] && RESULTS="$RESULTS,"
+	RESULTS="$RESULTS
+    { \"target\": \"$name\", \"engine\": \"$engine\", \"output\": \"$mode\", \"requests\": $COUNT, \"ns_per_request\": $best, \"iops\": $((1000000000 / best)) }"
+}
+
+[ -x "$IOPING" ] || { echo "$IOPING: not executable" >&2; exit 2; }
+[ "$COUNT" -ge "$MIN_COUNT" ] 2>/dev/null ||
+	{ echo "BENCH_COUNT must be at least $MIN_COUNT" >&2; exit 1; }
+
+TARGETS=
+
+if command -v python3 >/dev/null 2>&1 &&
+   python3 -c 'import os; os.memfd_create' 2>/dev/null; then
+	TARGETS="memfd:memfd"
+else
+	echo "skip memfd: python3 with os.memfd_create required" >&2
+fi
+
+if [ -d /dev/shm ] && SHMDIR=$(mktemp -d /dev/shm/ioping-bench.XXXXXX); then
+	TARGETS="$TARGETS tmpfs:$SHMDIR"
+else
+	SHMDIR=
+	echo "skip tmpfs: /dev/shm required" >&2
+fi
+
+TARGETS="$TARGETS zero:/dev/zero"
+
+if [ "$(id -u)" = 0 ] && command -v losetup >/dev/null 2>&1; then
+	dd if=/dev/zero of="$TMPDIR/loop.img" bs=1M count=16 2>/dev/null
+	LOOPDEV=$(losetup -f --show "$TMPDIR/loop.img" 2>/dev/null)
+	[ -n "$LOOPDEV" ] && TARGETS="$TARGETS loop:$LOOPDEV"
+fi
+[ -n "$LOOPDEV" ] || echo "skip loop: root and losetup required" >&2
+
+RESULTS=
+for t in $TARGETS; do
+	for e in $ENGINES; do
+		for m in $MODES; do
+			bench "${t%%:*}" "${t#*:}" "${e%%:*}" "${m%%:*}" \
+				${e#*:} ${m#*:}
+		done
+	done
+done
+
+cat > "$OUTPUT" <<EOF
+{
+  "version": "$("$IOPING" -v | cut -d' ' -f2)",
+  "kernel": "$(uname -sr)",
+  "machine": "$(uname -m)",
+  "timestamp": $(date +%s),
+  "count": $COUNT,
+  "repeat": $REPEAT,
+  "results": [$RESULTS
+  ]
+}
+EOF
+
+echo "results saved into $OUTPUT"
@@ -0,0 +1,453 @@
+/*
+ *  ioping-test  -- unit tests and microbenchmarks for ioping internals
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#define IOPING_NO_MAIN
+#include "ioping.c"
+
+static int failures;
+
+#define CHECK(cond) do {						\
+	if (!(cond)) {							\
+		fprintf(stderr, "%s:%d: check failed: %s\n",		\
+			__FILE__, __LINE__, #cond);			\
+		failures++;						\
+	}								\
+} while (0)
+
+#define BENCH(name, loops, stmt) do {					\
+	long long _start = now(), _i;					\
+	for (_i = 0; _i < (loops); _i++) {				\
+		stmt;							\
+	}								\
+	printf("%-28s %10.2f ns/op\n", name,				\
+	       (double)(now() - _start) / (loops));			\
+} while (0)
+
+static volatile unsigned long long sink;
+
+static void seed(unsigned long long entropy)
+{
+	random_entropy = entropy;
+	random_init();
+}
+
+static void test_parse_suffix(void)
+{
+	CHECK(parse_size("4k") == 4096);
+	CHECK(parse_size("1MiB") == 1 << 20);
+	CHECK(parse_size("2sector") == 1024);
+	CHECK(parse_size("1page") == 4096);
+	CHECK(parse_size("123") == 123);
+	CHECK(parse_offset("1t") == 1ll << 40);
+	CHECK(parse_int("10k") == 10000);
+	CHECK(parse_int("1/2k") == 500);
+	CHECK(parse_time("1.5ms") == 1500000);
+	CHECK(parse_time("2") == 2 * NSEC_PER_SEC);
+	CHECK(parse_time("1/4s") == NSEC_PER_SEC / 4);
+	CHECK(parse_time("1min") == 60 * NSEC_PER_SEC);
+	CHECK(parse_time("10US") == 10000);
+	CHECK(parse_ratio("1%") == 0.01);
+	CHECK(parse_rwf("none", 0) == 0);
+	CHECK(parse_rwf("dsync,dontcache", 0) == (RWF_DSYNC | RWF_DONTCACHE));
+	CHECK(!strcmp(rwf_string(RWF_DONTCACHE | RWF_DSYNC), "dsync,dontcache"));
+	CHECK(!strcmp(rwf_string(RWF_FDATASYNC), "fdatasync"));
+	CHECK(!strcmp(rwf_string(0), "none"));
+}
+
+static void test_random(void)
+{
+	unsigned long long a[64], b[64];
+	unsigned char m1[37 + 8], m2[37 + 8];
+	int i, same;
+
+	/* same seed gives the same sequence */
+	seed(42);
+	for (i = 0; i < 64; i++)
+		a[i] = random64();
+	seed(42);
+	for (i = 0; i < 64; i++)
+		b[i] = random64();
+	CHECK(!memcmp(a, b, sizeof(a)));
+
+	seed(43);
+	for (i = 0, same = 0; i < 64; i++)
+		same += random64() == a[i];
+	CHECK(same == 0);
+
+	/* fills exactly len bytes, including tail */
+	memset(m1, 0xAA, sizeof(m1));
+	memset(m2, 0xAA, sizeof(m2));
+	seed(7);
+	random_memory(m1, 37);
+	seed(7);
+	random_memory(m2, 37);
+	CHECK(!memcmp(m1, m2, sizeof(m1)));
+	for (i = 37; i < (int)sizeof(m1); i++)
+		CHECK(m1[i] == 0xAA);
+	for (i = 32, same = 0; i < 37; i++)
+		same += m1[i] == 0xAA;
+	CHECK(same < 5);
+}
+
+/* every request of working set is visited once per cycle */
+static int full_cycle(int pattern, off_t arg, off_t blocks)
+{
+	static unsigned char seen[1000];
+	off_t i, off;
+
+	offset_pattern = pattern;
+	pattern_arg = arg;
+	wsize = blocks * size;
+	offset_setup();
+	memset(seen, 0, sizeof(seen));
+	for (i = 0; i < blocks; i++) {
+		off = next_offset();
+		if (off < 0 || off >= blocks || seen[off]++)
+			return 0;
+	}
+	return 1;
+}
+
+static void test_offsets(void)
+{
+	off_t blocks, i, off;
+
+	size = 4096;
+	for (blocks = 1; blocks <= 33; blocks++) {
+		CHECK(full_cycle(PATTERN_LINEAR, 0, blocks));
+		CHECK(full_cycle(PATTERN_REVERSE, 0, blocks));
+		CHECK(full_cycle(PATTERN_BUTTERFLY, 0, blocks));
+		CHECK(full_cycle(PATTERN_STRIDE, 0, blocks));
+		CHECK(full_cycle(PATTERN_STRIDE, 2, blocks));
+		CHECK(full_cycle(PATTERN_STRIDE, 40, blocks));
+	}
+
+	for (blocks = 1; blocks <= 1000; blocks += blocks < 40 ? 1 : 97)
+		CHECK(full_cycle(PATTERN_PERMUTE, 0, blocks));
+
+	/* cycle repeats */
+	CHECK(full_cycle(PATTERN_STRIDE, 3, 10));
+	CHECK(next_offset() == 0);
+
+	/* permutation depends only on seed, changes every cycle */
+	{
+		off_t a[20], b[20];
+
+		seed(5);
+		full_cycle(PATTERN_PERMUTE, 0, 10);
+		for (i = 0; i < 20; i++)
+			a[i] = next_offset();
+		seed(5);
+		full_cycle(PATTERN_PERMUTE, 0, 10);
+		for (i = 0; i < 20; i++)
+			b[i] = next_offset();
+		CHECK(!memcmp(a, b, sizeof(a)));
+		CHECK(memcmp(a, a + 10, sizeof(a) / 2));
+	}
+
+	/* multiply-shift range reduction */
+	{
+		int count[3] = { 0, 0, 0 };
+
+		seed(6);
+		for (i = 0; i < 30000; i++)
+			count[random_range(3)]++;
+		for (i = 0; i < 3; i++)
+			CHECK(count[i] > 9500 && count[i] < 10500);
+		CHECK(random_range(1) == 0);
+	}
+
+	/* window slides and stays inside working set */
+	seed(3);
+	offset_pattern = PATTERN_WINDOW;
+	pattern_arg = 4 * size;
+	wsize = 10 * size;
+	offset_setup();
+	for (i = 0; i < 100; i++) {
+		off = next_offset();
+		CHECK(off >= i % 7 && off < i % 7 + 4);
+	}
+
+	/* round-robin streams walk own regions */
+	offset_pattern = PATTERN_DEFAULT;
+	nr_streams = 3;
+	wsize = 10 * size;
+	offset_setup();
+	CHECK(stream_blocks == 3);
+	for (i = 0; i < 9; i++) {
+		off = next_offset();
+		CHECK(offset_stream == i % 3);
+		CHECK(off == (i % 3) * 3 + i / 3);
+	}
+	CHECK(next_offset() == 0);
+	free(stream_pos);
+	nr_streams = 0;
+}
+
+static void test_histogram(void)
+{
+	unsigned long long val;
+	int i, prev = -1;
+
+	for (i = 0; i < HIST_SIZE; i++) {
+		CHECK(hist_index(hist_lower(i)) == i);
+		CHECK(hist_index(hist_upper(i) - 1) == i);
+		if (i + 1 < HIST_SIZE)
+			CHECK(hist_upper(i) == hist_lower(i + 1));
+	}
+
+	seed(1);
+	for (i = 0; i < 10000; i++) {
+		val = random64() >> (random64() % 64);
+		CHECK(hist_lower(hist_index(val)) <= (long long)val);
+		CHECK(hist_index(val) < HIST_SIZE);
+	}
+
+	for (val = 1; val < (1ull << 40); val = val * 3 / 2 + 1) {
+		CHECK(hist_index(val) >= prev);
+		prev = hist_index(val);
+	}
+}
+
+static void fill_statistics(struct statistics *s, long long from,
+			    long long to, long long step)
+{
+	long long val;
+
+	start_statistics(s, 0);
+	for (val = from; val < to; val += step)
+		add_statistics(s, size, val);
+}
+
+static int same_double(double a, double b)
+{
+	return fabs(a - b) <= fabs(a) * 1e-12;
+}
+
+/* floating point sums are equal only up to rounding */
+static int same_statistics(struct statistics *a, struct statistics *b)
+{
+	return a->count == b->count && a->valid == b->valid &&
+		a->too_fast == b->too_fast && a->too_slow == b->too_slow &&
+		a->failed == b->failed && a->min == b->min &&
+		a->max == b->max && same_double(a->sum, b->sum) &&
+		same_double(a->sum2, b->sum2) &&
+		!memcmp(a->hist, b->hist, sizeof(a->hist));
+}
+
+static void test_statistics(void)
+{
+	static struct statistics s, a, b, c, ab_c, a_bc, bc;
+	static const long long vals[] = { 2, 4, 4, 4, 5, 5, 7, 9 };
+	struct percentile r;
+	unsigned i;
+
+	size = 4096;
+	warmup_request = 0;
+	request = 1;
+	min_valid_time = 0;
+	max_valid_time = LLONG_MAX;
+
+	start_statistics(&s, 0);
+	for (i = 0; i < sizeof(vals) / sizeof(vals[0]); i++)
+		CHECK(add_statistics(&s, size, vals[i]));
+	CHECK(!add_statistics(&s, -1, 100));
+	finish_statistics(&s, NSEC_PER_SEC);
+	CHECK(s.count == 9 && s.valid == 8 && s.failed == 1);
+	CHECK(s.min == 2 && s.max == 9);
+	CHECK(s.avg == 5 && s.mdev == 2);
+	CHECK(s.size == 8 * size && s.load_size == 9 * size);
+	CHECK(s.load_iops == 9);
+
+	/* warmup and validity limits */
+	warmup_request = 5;
+	start_statistics(&s, 0);
+	CHECK(!add_statistics(&s, size, 10) && s.valid == 0);
+	warmup_request = 0;
+	min_valid_time = 5;
+	max_valid_time = 50;
+	CHECK(!add_statistics(&s, size, 1) && s.too_fast == 1);
+	CHECK(!add_statistics(&s, size, 100) && s.too_slow == 1);
+	CHECK(add_statistics(&s, size, 10) && s.valid == 1);
+	min_valid_time = 0;
+	max_valid_time = LLONG_MAX;
+
+	/* merge is associative and commutative */
+	fill_statistics(&a, 1000, 50000, 7);
+	fill_statistics(&b, 30, 900000, 1001);
+	fill_statistics(&c, 5000000, 6000000, 999);
+
+	start_statistics(&ab_c, 0);
+	merge_statistics(&ab_c, &a);
+	merge_statistics(&ab_c, &b);
+	merge_statistics(&ab_c, &c);
+
+	start_statistics(&bc, 0);
+	merge_statistics(&bc, &c);
+	merge_statistics(&bc, &b);
+	start_statistics(&a_bc, 0);
+	merge_statistics(&a_bc, &bc);
+	merge_statistics(&a_bc, &a);
+	CHECK(same_statistics(&ab_c, &a_bc));
+
+	/* empty statistics */
+	start_statistics(&s, 0);
+	merge_statistics(&ab_c, &s);
+	CHECK(same_statistics(&ab_c, &a_bc));
+	finish_statistics(&s, 0);
+	CHECK(s.min == 0 && s.max == 0 && s.avg == 0 && s.iops == 0);
+
+	/* percentiles within histogram resolution */
+	fill_statistics(&s, 1, 100001, 1);
+	finish_statistics(&s, 0);
+	get_percentile(&s, 50, &r);
+	CHECK(fabs(r.value - 50000) < 50000.0 / HIST_SUB);
+	CHECK(r.lower <= r.value && r.value <= r.upper);
+	get_percentile(&s, 99, &r);
+	CHECK(fabs(r.value - 99000) < 99000.0 / HIST_SUB);
+}
+
+static void test_precondition(void)
+{
+	double flat[] = { 100, 110, 95, 105, 100 };
+	double wide[] = { 100, 125, 100, 100, 100 };
+	double ramp[] = { 94, 96, 100, 104, 106 };
+	double zero[] = { 0, 0, 0, 0, 0 };
+	unsigned long long state[2];
+
+	/* steady state: range within 20%, fit excursion within 10% */
+	CHECK(steady_state(flat, 5));
+	CHECK(!steady_state(wide, 5));
+	CHECK(!steady_state(ramp, 5));
+	CHECK(!steady_state(zero, 5));
+
+	/* own random stream does not move offsets of measurement */
+	seed(1);
+	memcpy(state, random_state, sizeof(state));
+	precondition_random_setup();
+	(void)xorshift128p(precondition_random);
+	CHECK(!memcmp(state, random_state, sizeof(state)));
+}
+
+static void test_schedule(void)
+{
+	int index = 0;
+	long long t;
+
+	add_segment("0-10@10s");
+	add_segment("100@1s");
+	add_segment("0@1s");
+	add_segment("10-0@10s");
+
+	/* ramp from zero: integral of rate reaches 1 at sqrt(2) seconds */
+	t = schedule_interval(0, &index);
+	CHECK(index == 0);
+	CHECK(llabs(t - 1414213562) < 1000);
+
+	/* second request is due at 2 seconds */
+	t = schedule_interval(1414213562, &index);
+	CHECK(llabs(t - 585786438) < 1000);
+
+	/* constant rate */
+	t = schedule_interval(10 * NSEC_PER_SEC, &index);
+	CHECK(index == 1);
+	CHECK(t == NSEC_PER_SEC / 100);
+
+	/* constant zero rate is no limit */
+	t = schedule_interval(11 * NSEC_PER_SEC, &index);
+	CHECK(index == 2);
+	CHECK(t == 0);
+
+	/* falling ramp ends before next request */
+	t = schedule_interval(12 * NSEC_PER_SEC + 19 * NSEC_PER_SEC / 2, &index);
+	CHECK(index == 3);
+	CHECK(t == NSEC_PER_SEC / 2);
+
+	t = schedule_interval(22 * NSEC_PER_SEC, &index);
+	CHECK(index == 4 && t == 0);
+
+	while (nr_segments)
+		free(schedule[--nr_segments].text);
+	free(schedule);
+	schedule = NULL;
+	schedule_length = 0;
+}
+
+static void bench_kernels(void)
+{
+	static struct statistics s, o;
+	long long loops = 10000000;
+	char *mem;
+
+	mem = malloc(1 << 20);
+	if (!mem)
+		err(2, NULL);
+
+	seed(1);
+	start_statistics(&s, 0);
+	fill_statistics(&o, 1000, 1000000, 97);
+
+	BENCH("random64", loops, sink += random64());
+	BENCH("random_memory 4KiB", loops / 100, random_memory(mem, 4096));
+	BENCH("random_memory 1MiB", loops / 10000, random_memory(mem, 1 << 20));
+	wsize = 1 << 30;
+	offset_pattern = PATTERN_RANDOM;
+	offset_setup();
+	BENCH("offset random", loops, sink += next_offset());
+	offset_pattern = PATTERN_BUTTERFLY;
+	offset_setup();
+	BENCH("offset butterfly", loops, sink += next_offset());
+	offset_pattern = PATTERN_PERMUTE;
+	offset_setup();
+	BENCH("offset permute", loops, sink += next_offset());
+	BENCH("hist_index", loops, sink += hist_index(sink + _i * 7919));
+	BENCH("add_statistics", loops,
+	      add_statistics(&s, size, 1000 + (_i & 0xffff)));
+	BENCH("merge_statistics", loops / 1000, merge_statistics(&s, &o));
+	BENCH("finish_statistics", loops / 10, finish_statistics(&s, 1));
+	BENCH("start_statistics", loops / 1000, start_statistics(&o, 0));
+	BENCH("parse_size", loops / 10, sink += parse_size("64KiB"));
+	BENCH("parse_time", loops / 10, sink += parse_time("1.5ms"));
+
+	free(mem);
+}
+
+int main(int argc, char **argv)
+{
+	(void)argv;
+
+	test_parse_suffix();
+	test_random();
+	test_offsets();
+	test_histogram();
+	test_statistics();
+	test_precondition();
+	test_schedule();
+
+	if (failures) {
+		fprintf(stderr, "%d checks failed\n", failures);
+		return 1;
+	}
+	printf("all checks passed\n");
+
+	/* any argument skips microbenchmarks */
+	if (argc < 2)
+		bench_kernels();
+
+	return 0;
+}
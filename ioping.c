@@ -57,6 +57,16 @@
 # include <sys/ioctl.h>
 # include <sys/sysmacros.h>
 # include <sys/syscall.h>
+# include <sys/xattr.h>
+# include <linux/version.h>
+# if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 10, 0)
+#  include <linux/blkzoned.h>
+# endif
+# if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 4, 0)
+#  include <linux/nvme_ioctl.h>
+#  define HAVE_NVME_IOCTL
+# endif
+# include <linux/fiemap.h>
 # define HAVE_CLOCK_GETTIME
 # define HAVE_POSIX_FADVICE
 # define HAVE_POSIX_MEMALIGN
@@ -65,11 +75,30 @@
 # define HAVE_LINUX_ASYNC_IO
 # define HAVE_ERR_INCLUDE
 # define HAVE_STATVFS
+# define HAVE_THREAD_CPU_USAGE
+# define HAVE_PERF_EVENTS
+# define HAVE_CGROUP
+# define HAVE_FALLOCATE
+# define HAVE_XATTR
+# ifdef BLKFINISHZONE
+#  define HAVE_ZONED
+# endif
+# if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 9, 0)
+#  define HAVE_ZONE_CAPACITY
+# endif
 # define MAX_RW_COUNT		0x7ffff000 /* 2G - 4K */
 
 # undef RWF_NOWAIT
 # include <linux/fs.h>
 # include <linux/aio_abi.h>
+# if defined(__NR_copy_file_range) && defined(FIDEDUPERANGE)
+#  define HAVE_COPY
+# endif
+# include <sys/socket.h>
+# include <sys/sendfile.h>
+# define HAVE_ZEROCOPY
+# include <scsi/sg.h>
+# define HAVE_SGIO
 # ifndef RWF_NOWAIT
 #  define aio_rw_flags aio_reserved1
 # endif
@@ -92,6 +121,26 @@
 #  define RWF_HIPRI	0x00000001
 # endif
 
+# ifndef RWF_DSYNC
+#  define RWF_DSYNC	0x00000002
+# endif
+
+# ifndef RWF_SYNC
+#  define RWF_SYNC	0x00000004
+# endif
+
+# ifndef RWF_APPEND
+#  define RWF_APPEND	0x00000010
+# endif
+
+# ifndef RWF_ATOMIC
+#  define RWF_ATOMIC	0x00000040
+# endif
+
+# ifndef RWF_DONTCACHE
+#  define RWF_DONTCACHE	0x00000080
+# endif
+
 #else /* __linux__ */
 
 # ifndef RWF_NOWAIT
@@ -102,6 +151,26 @@
 #  define RWF_HIPRI	0
 # endif
 
+# ifndef RWF_DSYNC
+#  define RWF_DSYNC	0
+# endif
+
+# ifndef RWF_SYNC
+#  define RWF_SYNC	0
+# endif
+
+# ifndef RWF_APPEND
+#  define RWF_APPEND	0
+# endif
+
+# ifndef RWF_ATOMIC
+#  define RWF_ATOMIC	0
+# endif
+
+# ifndef RWF_DONTCACHE
+#  define RWF_DONTCACHE	0
+# endif
+
 #endif /* __linux__ */
 
 #ifdef __gnu_hurd__
@@ -190,6 +259,82 @@
 # include <sys/statvfs.h>
 #endif
 
+#ifdef HAVE_THREAD_CPU_USAGE
+# include <sched.h>
+# include <sys/resource.h>
+#endif
+
+#ifdef HAVE_PERF_EVENTS
+# include <sys/mman.h>
+# include <linux/perf_event.h>
+#endif
+
+/*
+ * USDT static tracepoints, provider "ioping". Disabled probe costs a nop,
+ * tracer finds it in ELF note .note.stapsdt, for example:
+ * bpftrace -e 'usdt:./ioping:ioping:request_done { @[arg3] = count(); }'
+ * Without <sys/sdt.h> the same note is emitted here for x86_64 and aarch64.
+ */
+#if defined(__has_include)
+# if __has_include(<sys/sdt.h>)
+#  include <sys/sdt.h>
+#  define HAVE_SDT
+# endif
+#endif
+
+#if defined(HAVE_SDT)
+
+# define PROBE3(name, a, b, c) \
+	DTRACE_PROBE3(ioping, name, (long long)(a), (long long)(b), \
+		      (long long)(c))
+# define PROBE5(name, a, b, c, d, e) \
+	DTRACE_PROBE5(ioping, name, (long long)(a), (long long)(b), \
+		      (long long)(c), (long long)(d), (long long)(e))
+
+#elif defined(__linux__) && (defined(__x86_64__) || defined(__aarch64__))
+
+# define SDT_NOTE(name, args)						\
+	"990:	nop\n"							\
+	".pushsection .note.stapsdt,\"?\",\"note\"\n"			\
+	".balign 4\n"							\
+	".4byte 992f-991f, 994f-993f, 3\n"				\
+	"991:	.asciz \"stapsdt\"\n"					\
+	"992:	.balign 4\n"						\
+	"993:	.8byte 990b\n"						\
+	".8byte _.stapsdt.base\n"					\
+	".8byte 0\n"							\
+	".asciz \"ioping\"\n"						\
+	".asciz \"" #name "\"\n"					\
+	".asciz \"" args "\"\n"						\
+	"994:	.balign 4\n"						\
+	".popsection\n"							\
+	".ifndef _.stapsdt.base\n"					\
+	".pushsection .stapsdt.base,\"aG\",\"progbits\",.stapsdt.base,comdat\n" \
+	".weak _.stapsdt.base\n"					\
+	".hidden _.stapsdt.base\n"					\
+	"_.stapsdt.base: .space 1\n"					\
+	".size _.stapsdt.base, 1\n"					\
+	".popsection\n"							\
+	".endif\n"
+
+# define PROBE3(name, a, b, c)						\
+	__asm__ __volatile__(SDT_NOTE(name, "-8@%0 -8@%1 -8@%2")	\
+		:: "nor" ((long long)(a)), "nor" ((long long)(b)),	\
+		   "nor" ((long long)(c)))
+# define PROBE5(name, a, b, c, d, e)					\
+	__asm__ __volatile__(SDT_NOTE(name,				\
+			"-8@%0 -8@%1 -8@%2 -8@%3 -8@%4")		\
+		:: "nor" ((long long)(a)), "nor" ((long long)(b)),	\
+		   "nor" ((long long)(c)), "nor" ((long long)(d)),	\
+		   "nor" ((long long)(e)))
+
+#else
+
+# define PROBE3(name, a, b, c)		do { } while (0)
+# define PROBE5(name, a, b, c, d, e)	do { } while (0)
+
+#endif
+
 #ifdef HAVE_ERR_INCLUDE
 # include <err.h>
 #else
@@ -547,6 +692,23 @@ long long parse_time(const char *str)
 	return parse_suffix(str, time_suffix, 0, LLONG_MAX);
 }
 
+/* fraction, "1%" is the same as "0.01" */
+double parse_ratio(const char *str)
+{
+	char *end;
+	double val;
+
+	val = strtod(str, &end);
+	if (*end == '%') {
+		val /= 100;
+		end++;
+	}
+	if (*end || end == str || val < 0)
+		errx(1, "invalid ratio: \"%s\"", str);
+	return val;
+}
+
+
 void print_suffix(long long val, struct suffix *sfx)
 {
 	int precision;
@@ -597,6 +759,14 @@ int batch_mode = 0;
 int direct = 0;
 int cached = 0;
 int rw_flags = 0;
+
+/* pseudo flag: fdatasync after each write, only in flag matrix */
+#define RWF_FDATASYNC	(1 << 30)
+#define MAX_RWF_SETS	16
+
+int rwf_sets[MAX_RWF_SETS];
+int nr_rwf_sets = 0;
+int rwf_set;
 int syncio = 0;
 int data_syncio = 0;
 int randomize = 1;
@@ -638,10 +808,171 @@ long long stop_at_request = 0;
 int json = 0;
 int json_line = 0;
 
+int cpu_stats = 0;
+int perf_stats = 0;
+int breakdown = 0;
+int pressure = 0;
+long long throttle_threshold = 0;
+
+char *cgroup_settings = NULL;
+
+#define MAX_CGROUP_WEIGHTS	16
+
+unsigned cgroup_weights[MAX_CGROUP_WEIGHTS];
+int nr_cgroup_weights = 0;
+
+/* load schedule: request rate is constant or changes linearly */
+struct segment {
+	char	*text;
+	double	from, to;	/* requests per second, both 0 - no limit */
+	long long start, duration;
+};
+
+struct segment *schedule = NULL;
+int nr_segments = 0;
+long long schedule_length = 0;
+
+enum {
+	ARRIVAL_FIXED,
+	ARRIVAL_EXP,
+	ARRIVAL_ONOFF,
+	ARRIVAL_MMPP,
+};
+
+int nr_streams = 0;
+int stream_random = 0;
+
+enum {
+	PATTERN_DEFAULT,
+	PATTERN_RANDOM,
+	PATTERN_LINEAR,
+	PATTERN_REVERSE,
+	PATTERN_STRIDE,
+	PATTERN_BUTTERFLY,
+	PATTERN_WINDOW,
+	PATTERN_PERMUTE,
+};
+
+int offset_pattern = PATTERN_DEFAULT;
+off_t pattern_arg = 0;
+
+int precondition = 0;
+int precondition_passes = 0;
+long long precondition_round = 10 * NSEC_PER_SEC;
+
+enum {
+	ALLOCATE_NONE,
+	ALLOCATE_SPARSE,
+	ALLOCATE_UNWRITTEN,
+};
+
+int allocate = ALLOCATE_NONE;
+const char *allocate_mode = NULL;
+
+enum {
+	COPY_NONE,
+	COPY_RANGE,
+	COPY_CLONE,
+	COPY_DEDUPE,
+};
+
+int copy_mode = COPY_NONE;
+const char *copy_name = NULL;
+
+enum {
+	ZEROCOPY_NONE,
+	ZEROCOPY_SPLICE,
+	ZEROCOPY_SENDFILE,
+};
+
+int zerocopy = ZEROCOPY_NONE;
+const char *zerocopy_name = NULL;
+
+int sgio = 0;
+
+int zoned = 0;
+int zone_append = 0;
+int zone_open = 0;
+off_t zone_finish = 0;
+
+int arrival = ARRIVAL_FIXED;
+const char *arrival_model = NULL;
+long long arrival_time[2] = { NSEC_PER_SEC, NSEC_PER_SEC };
+double arrival_ratio = 10;
+
+char *trace_path = NULL;
+FILE *trace_file = NULL;
+char *histogram_path = NULL;
+
+int compare = 0;
+char *compare_path = NULL;
+
+#define MAX_PERCENTILES	16
+
+double percentiles[MAX_PERCENTILES];
+int nr_percentiles = 0;
+
+double converge = 0;
+int converged = 0;
+
+enum {
+	SLO_PERCENTILE,
+	SLO_MIN,
+	SLO_AVG,
+	SLO_MAX,
+	SLO_MDEV,
+	SLO_IOPS,
+	SLO_BPS,
+	SLO_ERRORS,
+};
+
+struct slo {
+	char	*text;
+	int	metric;
+	double	percentile;
+	int	below, equal;
+	double	limit;
+};
+
+#define MAX_SLO		16
+
+struct slo slo[MAX_SLO];
+int nr_slo = 0;
+int slo_period_failed = 0;
+
 int exiting = 0;
 
 const char *options = "hvkALRDNHCWGEYBqyi:t:T:w:s:S:c:o:p:P:l:r:a:I::Je:b:";
 
+/* long-only options */
+enum {
+	OPT_TRACE = 256,
+	OPT_HISTOGRAM,
+	OPT_COMPARE,
+	OPT_PERCENTILES,
+	OPT_CONVERGE,
+	OPT_SLO,
+	OPT_CPU,
+	OPT_PERF,
+	OPT_BREAKDOWN,
+	OPT_PRESSURE,
+	OPT_THROTTLE,
+	OPT_CGROUP,
+	OPT_CGROUP_WEIGHTS,
+	OPT_SCHEDULE,
+	OPT_ARRIVAL,
+	OPT_STREAMS,
+	OPT_PATTERN,
+	OPT_PRECONDITION,
+	OPT_ALLOCATE,
+	OPT_ZONED,
+	OPT_COPY,
+	OPT_ZEROCOPY,
+	OPT_SGIO,
+	OPT_RWF,
+	OPT_RWF_MATRIX,
+};
+
 #ifdef HAVE_GETOPT_LONG_ONLY
 
 static struct option long_options[] = {
@@ -689,6 +1020,32 @@ static struct option long_options[] = {
 
 	{"entropy",	required_argument,	NULL,	'e'},
 
+	{"trace",	required_argument,	NULL,	OPT_TRACE},
+	{"histogram",	required_argument,	NULL,	OPT_HISTOGRAM},
+	{"compare",	no_argument,		NULL,	OPT_COMPARE},
+	{"percentiles",	required_argument,	NULL,	OPT_PERCENTILES},
+	{"converge",	required_argument,	NULL,	OPT_CONVERGE},
+	{"slo",		required_argument,	NULL,	OPT_SLO},
+	{"cpu",		no_argument,		NULL,	OPT_CPU},
+	{"perf",	no_argument,		NULL,	OPT_PERF},
+	{"breakdown",	no_argument,		NULL,	OPT_BREAKDOWN},
+	{"pressure",	no_argument,		NULL,	OPT_PRESSURE},
+	{"throttle",	required_argument,	NULL,	OPT_THROTTLE},
+	{"cgroup",	required_argument,	NULL,	OPT_CGROUP},
+	{"cgroup-weights", required_argument,	NULL,	OPT_CGROUP_WEIGHTS},
+	{"schedule",	required_argument,	NULL,	OPT_SCHEDULE},
+	{"arrival",	required_argument,	NULL,	OPT_ARRIVAL},
+	{"streams",	required_argument,	NULL,	OPT_STREAMS},
+	{"pattern",	required_argument,	NULL,	OPT_PATTERN},
+	{"precondition",	required_argument,	NULL,	OPT_PRECONDITION},
+	{"allocate",	required_argument,	NULL,	OPT_ALLOCATE},
+	{"zoned",	required_argument,	NULL,	OPT_ZONED},
+	{"copy",	required_argument,	NULL,	OPT_COPY},
+	{"zerocopy",	required_argument,	NULL,	OPT_ZEROCOPY},
+	{"sgio",	no_argument,		NULL,	OPT_SGIO},
+	{"rwf",		required_argument,	NULL,	OPT_RWF},
+	{"rwf-matrix",	required_argument,	NULL,	OPT_RWF_MATRIX},
+
 	{0,		0,			NULL,	0},
 };
 
@@ -698,6 +1055,7 @@ void usage(FILE *output)
 {
 	fprintf(output,
 			" Usage: ioping [options...] directory|file|device\n"
+			"        ioping -compare [-e seed] <baseline> <result>\n"
 			"        ioping -h | -v\n"
 			"\n"
 			" options:\n"
@@ -709,12 +1067,36 @@ void usage(FILE *output)
 			"      -L, -linear                use sequential operations\n"
 			"      -N, -nowait                use nowait I/O (RWF_NOWAIT)\n"
 			"      -H, -hipri                 use high priority I/O (RWF_HIPRI)\n"
+			"      -rwf <flags>               per-request RWF flags: dsync,sync,append,dontcache,...\n"
+			"      -rwf-matrix <set>:<set>... cycle flag sets on same offsets and compare\n"
 			"      -W, -write                 use write I/O (please read manpage)\n"
 			"      -Y, -sync                  use sync I/O (O_SYNC)\n"
 			"      -y, -dsync                 use data sync I/O (O_DSYNC)\n"
 			"      -R, -rapid                 test with rapid I/O during 3s (-q -i 0 -w 3)\n"
 			"      -k, -keep                  keep and reuse temporary file (ioping.tmp)\n"
+			"      -cpu                       account cpu time, context switches and migrations\n"
+			"      -perf                      count cycles, instructions, cache misses, page faults\n"
+			"      -breakdown                 split time into filesystem, queue and device\n"
+			"      -pressure                  sample pressure stalls, dirty memory and reclaim\n"
+			"      -throttle <time>           buffered writes, find dirty throttling above <time>\n"
+			"      -cgroup <key=value;...>    run in child cgroup with these io.* settings\n"
+			"      -cgroup-weights <list>     rotate io.weight every period\n"
+			"      -schedule <rate@time,...>  request rate schedule, \"from-to@time\" for ramp\n"
+			"      -arrival <model>           random arrivals: exp, onoff[:on:off], mmpp[:ratio:high:low]\n"
+			"      -streams <count>[:random]  interleave sequential streams over working set\n"
+			"      -pattern <name>            offsets: random, linear, reverse, stride:<count>,\n"
+			"                                 butterfly, window:<size>, permute\n"
+			"      -precondition <count>[:<time>]\n"
+			"                                 write <count> times, random <time> rounds until steady\n"
+			"      -allocate <mode>           first writes allocate: sparse, unwritten\n"
+			"      -zoned <mode>              write at zone write pointers: write, append,\n"
+			"                                 with \",open\", \",finish:<size>\"\n"
+			"      -copy <mode>               copy range into second file: copy, clone, dedupe\n"
+			"      -zerocopy <engine>         compare splice or sendfile reads against pread\n"
+			"      -sgio                      SCSI READ(16)/WRITE(16) by SG_IO, paired for block device\n"
 			"\n"
+	       );
+	fprintf(output,
 			" parameters:\n"
 			"      -a, -warmup <count>        ignore <count> first requests (1)\n"
 			"      -b, -burst <count>         make <count> requsts without delay (0)\n"
@@ -729,22 +1111,417 @@ void usage(FILE *output)
 			"      -r, -rate-limit <count>    limit rate with <count> per second\n"
 			"      -t, -min-time <time>       minimal valid request time (0us)\n"
 			"      -T, -max-time <time>       maximum valid request time\n"
+			"      -converge <error>          stop when percentiles are within relative error\n"
+			"      -slo <expr>                check objectives like \"p99<5ms,errors<0.1%%\"\n"
 			"\n"
 			" output:\n"
 			"      -B, -batch                 print final statistics in raw format\n"
 			"      -I, -time [format]         print current time for every request\n"
 			"      -J, -json                  print output in JSON format\n"
+			"      -percentiles <list>        print percentiles with confidence intervals\n"
 			"      -p, -print-count <count>   print statistics for every <count> requests\n"
 			"      -P, -print-interval <time> print statistics for every <time>\n"
 			"      -q, -quiet                 suppress human-readable output\n"
+			"      -trace <file>              save every request into binary trace\n"
+			"      -histogram <file>          save final latency histogram\n"
 			"      -h, -help                  display this message and exit\n"
 			"      -v, -version               display version and exit\n"
 			"\n"
 	       );
 }
 
+void parse_percentiles(const char *str)
+{
+	char *end;
+	double val;
+
+	nr_percentiles = 0;
+	do {
+		val = strtod(str, &end);
+		if (end == str || val <= 0 || val >= 100 ||
+		    (*end && *end != ','))
+			errx(1, "invalid percentile: \"%s\"", str);
+		if (nr_percentiles == MAX_PERCENTILES)
+			errx(1, "too many percentiles");
+		percentiles[nr_percentiles++] = val;
+		str = end + 1;
+	} while (*end);
+}
+
+void parse_cgroup_weights(const char *str)
+{
+	char *end;
+	long val;
+
+	nr_cgroup_weights = 0;
+	do {
+		val = strtol(str, &end, 10);
+		if (end == str || val < 1 || val > 10000 ||
+		    (*end && *end != ','))
+			errx(1, "invalid io.weight: \"%s\"", str);
+		if (nr_cgroup_weights == MAX_CGROUP_WEIGHTS)
+			errx(1, "too many weights");
+		cgroup_weights[nr_cgroup_weights++] = val;
+		str = end + 1;
+	} while (*end);
+}
+
+static double parse_rate(const char *str, const char *spec)
+{
+	if (!*str)
+		errx(1, "invalid schedule segment: \"%s\"", spec);
+	return parse_suffix(str, int_suffix, 0, NSEC_PER_SEC);
+}
+
+/* "rate@time" or "from-to@time" */
+void add_segment(const char *spec)
+{
+	struct segment *seg;
+	char *text, *at, *dash;
+
+	text = strdup(spec);
+	if (!text)
+		err(2, NULL);
+	at = strchr(text, '@');
+	if (!at)
+		errx(1, "invalid schedule segment: \"%s\"", spec);
+	*at++ = 0;
+
+	schedule = realloc(schedule, (nr_segments + 1) * sizeof(*schedule));
+	if (!schedule)
+		err(2, NULL);
+	seg = &schedule[nr_segments++];
+
+	dash = strchr(text, '-');
+	if (dash)
+		*dash++ = 0;
+	seg->from = parse_rate(text, spec);
+	seg->to = dash ? parse_rate(dash, spec) : seg->from;
+	seg->duration = parse_time(at);
+	if (seg->duration <= 0)
+		errx(1, "invalid schedule segment: \"%s\"", spec);
+	seg->start = schedule_length;
+	schedule_length += seg->duration;
+
+	/* keep original text for reports */
+	strcpy(text, spec);
+	seg->text = text;
+}
+
+/* comma separated segments, "@file" reads them from lines of file */
+void parse_schedule(const char *str)
+{
+	char line[256], *tok, *ptr;
+	FILE *file;
+
+	if (*str != '@') {
+		strncpy(line, str, sizeof(line) - 1);
+		line[sizeof(line) - 1] = 0;
+		if (strlen(str) >= sizeof(line))
+			errx(1, "schedule is too long, use @file");
+		for (tok = strtok(line, ","); tok; tok = strtok(NULL, ","))
+			add_segment(tok);
+		return;
+	}
+
+	file = fopen(str + 1, "r");
+	if (!file)
+		err(1, "failed to open schedule \"%s\"", str + 1);
+	while (fgets(line, sizeof(line), file)) {
+		ptr = strchr(line, '#');
+		if (ptr)
+			*ptr = 0;
+		for (tok = strtok(line, ", \t\n"); tok;
+		     tok = strtok(NULL, ", \t\n"))
+			add_segment(tok);
+	}
+	fclose(file);
+	if (!nr_segments)
+		errx(1, "empty schedule \"%s\"", str + 1);
+}
+
+/*
+ * Interval to next request at given time since start. Constant rate 0 means
+ * no limit, zero at the end of a ramp is just zero rate. Within a ramp one
+ * request is due when integral of rate reaches 1: r*t + k*t^2/2 = 1, where
+ * k is slope, root is taken in a form stable for k near 0. Wait at most
+ * till end of segment.
+ */
+static long long schedule_interval(long long elapsed, int *index)
+{
+	struct segment *seg;
+	double rate, slope, disc;
+	long long left;
+
+	while (*index < nr_segments &&
+	       elapsed >= schedule[*index].start + schedule[*index].duration)
+		(*index)++;
+	if (*index == nr_segments)
+		return 0;
+
+	seg = &schedule[*index];
+	if (seg->from == 0 && seg->to == 0)
+		return 0;
+
+	rate = seg->from + (seg->to - seg->from) *
+		(elapsed - seg->start) / seg->duration;
+	slope = (seg->to - seg->from) * NSEC_PER_SEC / seg->duration;
+	left = seg->start + seg->duration - elapsed;
+
+	/* falling rate reaches zero before next request */
+	disc = rate * rate + 2 * slope;
+	if (disc <= 0)
+		return left;
+
+	return fmin(2 / (rate + sqrt(disc)) * NSEC_PER_SEC, left);
+}
+
+/* for each segment of -schedule */
+static struct statistics *segment_stats;
+
+/* exp, onoff[:on[:off]] or mmpp[:ratio[:high[:low]]] */
+void parse_arrival(const char *str)
+{
+	char *copy, *tok, *end;
+	int i;
+
+	arrival_model = str;
+	copy = strdup(str);
+	if (!copy)
+		err(2, NULL);
+	tok = strtok(copy, ":");
+	if (tok && !strcmp(tok, "exp"))
+		arrival = ARRIVAL_EXP;
+	else if (tok && !strcmp(tok, "onoff"))
+		arrival = ARRIVAL_ONOFF;
+	else if (tok && !strcmp(tok, "mmpp"))
+		arrival = ARRIVAL_MMPP;
+	else
+		errx(1, "invalid arrival model: \"%s\"", str);
+
+	tok = strtok(NULL, ":");
+	if (tok && arrival == ARRIVAL_MMPP) {
+		arrival_ratio = strtod(tok, &end);
+		if (*end || end == tok || !(arrival_ratio >= 1))
+			errx(1, "invalid rate ratio: \"%s\"", tok);
+		tok = strtok(NULL, ":");
+	}
+	for (i = 0; i < 2 && tok && arrival != ARRIVAL_EXP; i++) {
+		arrival_time[i] = parse_time(tok);
+		if (arrival_time[i] <= 0)
+			errx(1, "invalid arrival state time: \"%s\"", tok);
+		tok = strtok(NULL, ":");
+	}
+	if (tok)
+		errx(1, "invalid arrival model: \"%s\"", str);
+	free(copy);
+}
+
+void parse_pattern(const char *str)
+{
+	const char *arg = strchr(str, ':');
+	size_t len = arg ? (size_t)(arg - str) : strlen(str);
+
+	if (arg)
+		arg++;
+	if (!strncmp(str, "random", len) && len == 6 && !arg)
+		offset_pattern = PATTERN_RANDOM;
+	else if (!strncmp(str, "linear", len) && len == 6 && !arg)
+		offset_pattern = PATTERN_LINEAR;
+	else if (!strncmp(str, "reverse", len) && len == 7 && !arg)
+		offset_pattern = PATTERN_REVERSE;
+	else if (!strncmp(str, "butterfly", len) && len == 9 && !arg)
+		offset_pattern = PATTERN_BUTTERFLY;
+	else if (!strncmp(str, "permute", len) && len == 7 && !arg)
+		offset_pattern = PATTERN_PERMUTE;
+	else if (!strncmp(str, "stride", len) && len == 6 && arg) {
+		offset_pattern = PATTERN_STRIDE;
+		pattern_arg = parse_int(arg);
+	} else if (!strncmp(str, "window", len) && len == 6 && arg) {
+		offset_pattern = PATTERN_WINDOW;
+		pattern_arg = parse_size(arg);
+	} else
+		errx(1, "invalid offset pattern: \"%s\"", str);
+	randomize = offset_pattern == PATTERN_RANDOM ||
+		    offset_pattern == PATTERN_PERMUTE;
+}
+
+static const struct {
+	const char *name;
+	int flag;
+} rwf_names[] = {
+	{ "hipri",	RWF_HIPRI },
+	{ "dsync",	RWF_DSYNC },
+	{ "sync",	RWF_SYNC },
+	{ "nowait",	RWF_NOWAIT },
+	{ "append",	RWF_APPEND },
+	{ "atomic",	RWF_ATOMIC },
+	{ "dontcache",	RWF_DONTCACHE },
+	{ "fdatasync",	RWF_FDATASYNC },
+};
+
+/* comma separated flag names or "none" */
+int parse_rwf(const char *str, int matrix)
+{
+	char *copy, *tok;
+	int flags = 0;
+	size_t i;
+
+	copy = strdup(str);
+	if (!copy)
+		err(2, NULL);
+	for (tok = strtok(copy, ","); tok; tok = strtok(NULL, ",")) {
+		if (!strcmp(tok, "none"))
+			continue;
+		for (i = 0; i < sizeof(rwf_names) / sizeof(rwf_names[0]); i++)
+			if (!strcmp(tok, rwf_names[i].name))
+				break;
+		if (i == sizeof(rwf_names) / sizeof(rwf_names[0]) ||
+		    (rwf_names[i].flag == RWF_FDATASYNC && !matrix))
+			errx(1, "invalid RWF flag: \"%s\"", tok);
+		if (!rwf_names[i].flag)
+			errx(1, "RWF flag \"%s\" not supported by this platform",
+			     tok);
+		flags |= rwf_names[i].flag;
+	}
+	free(copy);
+	return flags;
+}
+
+/* colon separated flag sets */
+void parse_rwf_matrix(const char *str)
+{
+	char *copy, *tok, *next;
+
+	copy = strdup(str);
+	if (!copy)
+		err(2, NULL);
+	nr_rwf_sets = 0;
+	for (tok = copy; tok; tok = next) {
+		next = strchr(tok, ':');
+		if (next)
+			*next++ = 0;
+		if (nr_rwf_sets == MAX_RWF_SETS)
+			errx(1, "too many RWF flag sets");
+		rwf_sets[nr_rwf_sets++] = parse_rwf(tok, 1);
+	}
+	free(copy);
+	if (nr_rwf_sets < 2)
+		errx(1, "RWF matrix requires at least two flag sets");
+}
+
+const char *rwf_string(int flags)
+{
+	static char str[128];
+	size_t i;
+
+	*str = 0;
+	for (i = 0; i < sizeof(rwf_names) / sizeof(rwf_names[0]); i++) {
+		if (!(flags & rwf_names[i].flag))
+			continue;
+		if (*str)
+			strcat(str, ",");
+		strcat(str, rwf_names[i].name);
+	}
+	return *str ? str : "none";
+}
+
+/* "write" or "append", optionally ",open" and ",finish:<size>" */
+void parse_zoned(const char *str)
+{
+	char *copy, *tok;
+
+	copy = strdup(str);
+	if (!copy)
+		err(2, NULL);
+	tok = strtok(copy, ",");
+	if (tok && !strcmp(tok, "write"))
+		zone_append = 0;
+	else if (tok && !strcmp(tok, "append"))
+		zone_append = 1;
+	else
+		errx(1, "invalid zoned mode: \"%s\"", str);
+	while ((tok = strtok(NULL, ","))) {
+		if (!strcmp(tok, "open"))
+			zone_open = 1;
+		else if (!strncmp(tok, "finish:", 7))
+			zone_finish = parse_size(tok + 7);
+		else
+			errx(1, "invalid zoned mode: \"%s\"", str);
+	}
+	free(copy);
+	zoned = 1;
+}
+
+void parse_slo(char *str)
+{
+	static const struct {
+		const char *name;
+		int metric;
+	} metrics[] = {
+		{ "min",	SLO_MIN },
+		{ "avg",	SLO_AVG },
+		{ "max",	SLO_MAX },
+		{ "mdev",	SLO_MDEV },
+		{ "iops",	SLO_IOPS },
+		{ "bps",	SLO_BPS },
+		{ "errors",	SLO_ERRORS },
+		{ NULL,		0 },
+	};
+	char *term, *op, *end;
+	struct slo *o;
+	int i;
+
+	while ((term = strsep(&str, ","))) {
+		if (nr_slo == MAX_SLO)
+			errx(1, "too many service level objectives");
+		o = &slo[nr_slo++];
+		o->text = strdup(term);
+
+		op = term + strcspn(term, "<>");
+		if (!*op)
+			errx(1, "invalid objective: \"%s\"", o->text);
+		o->below = *op == '<';
+		o->equal = op[1] == '=';
+		*op = 0;
+		op += o->equal ? 2 : 1;
+
+		if (term[0] == 'p') {
+			o->metric = SLO_PERCENTILE;
+			o->percentile = strtod(term + 1, &end);
+			if (end == term + 1 || *end ||
+			    o->percentile <= 0 || o->percentile >= 100)
+				errx(1, "invalid objective: \"%s\"", o->text);
+		} else {
+			for (i = 0; metrics[i].name; i++)
+				if (!strcmp(term, metrics[i].name))
+					break;
+			if (!metrics[i].name)
+				errx(1, "invalid objective: \"%s\"", o->text);
+			o->metric = metrics[i].metric;
+		}
+
+		switch (o->metric) {
+		case SLO_IOPS:
+			o->limit = parse_suffix(op, int_suffix, 0, LLONG_MAX);
+			break;
+		case SLO_BPS:
+			o->limit = parse_suffix(op, size_suffix, 0, LLONG_MAX);
+			break;
+		case SLO_ERRORS:
+			o->limit = parse_ratio(op);
+			/* failed requests are counted only with -E */
+			ignore_error = 1;
+			break;
+		default:
+			o->limit = parse_time(op);
+		}
+	}
+}
+
 void parse_options(int argc, char **argv)
 {
+	char *end;
 	int opt;
 
 	if (argc < 2) {
@@ -880,6 +1657,131 @@ void parse_options(int argc, char **argv)
 			case 'k':
 				keep_file = 1;
 				break;
+			case OPT_TRACE:
+				trace_path = optarg;
+				break;
+			case OPT_HISTOGRAM:
+				histogram_path = optarg;
+				break;
+			case OPT_COMPARE:
+				compare = 1;
+				break;
+			case OPT_PERCENTILES:
+				parse_percentiles(optarg);
+				break;
+			case OPT_CONVERGE:
+				converge = parse_ratio(optarg);
+				if (converge <= 0)
+					errx(1, "convergence error must be positive");
+				break;
+			case OPT_SLO:
+				parse_slo(optarg);
+				break;
+			case OPT_CPU:
+				cpu_stats = 1;
+				break;
+			case OPT_PERF:
+				perf_stats = 1;
+				break;
+			case OPT_BREAKDOWN:
+				breakdown = 1;
+				break;
+			case OPT_PRESSURE:
+				pressure = 1;
+				break;
+			case OPT_CGROUP:
+				cgroup_settings = optarg;
+				break;
+			case OPT_SCHEDULE:
+				parse_schedule(optarg);
+				break;
+			case OPT_ARRIVAL:
+				parse_arrival(optarg);
+				break;
+			case OPT_PATTERN:
+				parse_pattern(optarg);
+				break;
+			case OPT_STREAMS:
+				nr_streams = strtol(optarg, &end, 10);
+				if (end == optarg || nr_streams < 1 ||
+				    (*end && strcmp(end, ":rr") &&
+				     strcmp(end, ":random")))
+					errx(1, "invalid streams: \"%s\"", optarg);
+				stream_random = !strcmp(end, ":random");
+				randomize = 0;
+				break;
+			case OPT_PRECONDITION:
+				precondition = 1;
+				precondition_passes = strtol(optarg, &end, 10);
+				if (end == optarg || precondition_passes < 0 ||
+				    (*end && *end != ':'))
+					errx(1, "invalid precondition: \"%s\"",
+					     optarg);
+				if (*end)
+					precondition_round = parse_time(end + 1);
+				if (precondition_round <= 0)
+					errx(1, "precondition round must be positive");
+				break;
+			case OPT_ALLOCATE:
+				if (!strcmp(optarg, "sparse"))
+					allocate = ALLOCATE_SPARSE;
+				else if (!strcmp(optarg, "unwritten"))
+					allocate = ALLOCATE_UNWRITTEN;
+				else
+					errx(1, "invalid allocate mode: \"%s\"",
+					     optarg);
+				allocate_mode = optarg;
+				if (!write_test)
+					write_test++;
+				break;
+			case OPT_COPY:
+				if (!strcmp(optarg, "copy"))
+					copy_mode = COPY_RANGE;
+				else if (!strcmp(optarg, "clone"))
+					copy_mode = COPY_CLONE;
+				else if (!strcmp(optarg, "dedupe"))
+					copy_mode = COPY_DEDUPE;
+				else
+					errx(1, "invalid copy mode: \"%s\"",
+					     optarg);
+				copy_name = optarg;
+				break;
+			case OPT_ZEROCOPY:
+				if (!strcmp(optarg, "splice"))
+					zerocopy = ZEROCOPY_SPLICE;
+				else if (!strcmp(optarg, "sendfile"))
+					zerocopy = ZEROCOPY_SENDFILE;
+				else
+					errx(1, "invalid zero-copy engine: \"%s\"",
+					     optarg);
+				zerocopy_name = optarg;
+				cpu_stats = 1;
+				break;
+			case OPT_RWF:
+				rw_flags |= parse_rwf(optarg, 0);
+				break;
+			case OPT_RWF_MATRIX:
+				parse_rwf_matrix(optarg);
+				break;
+			case OPT_SGIO:
+				sgio = 1;
+				cpu_stats = 1;
+				break;
+			case OPT_ZONED:
+				parse_zoned(optarg);
+				if (!write_test)
+					write_test++;
+				break;
+			case OPT_CGROUP_WEIGHTS:
+				parse_cgroup_weights(optarg);
+				if (!cgroup_settings)
+					cgroup_settings = "";
+				break;
+			case OPT_THROTTLE:
+				throttle_threshold = parse_time(optarg);
+				if (throttle_threshold <= 0)
+					errx(1, "throttle time must be positive");
+				break;
 			case '?':
 				fprintf(stderr, "\n");
 				usage(stderr);
@@ -887,6 +1789,14 @@ void parse_options(int argc, char **argv)
 		}
 	}
 
+	if (compare) {
+		if (optind != argc-2)
+			errx(1, "compare requires baseline and result files");
+		path = argv[optind];
+		compare_path = argv[optind+1];
+		return;
+	}
+
 	if (optind > argc-1)
 		errx(1, "no destination specified");
 	if (optind < argc-1)
@@ -1296,7 +2206,8 @@ int open_file(const char *path, const char *temp)
 #endif
 
 	if (!temp) {
-		fd = open(path, (write_test ? O_RDWR : O_RDONLY) | flags);
+		fd = open(path, (write_test || precondition ?
+				 O_RDWR : O_RDONLY) | flags);
 		if (fd < 0)
 			goto out;
 		goto done;
@@ -1362,14 +2273,19 @@ void set_signal(void)
 static unsigned long long random_state[2];
 
 /* xorshift128+ */
-static inline unsigned long long random64(void)
+static inline unsigned long long xorshift128p(unsigned long long *state)
 {
-	unsigned long long s1 = random_state[0];
-	const unsigned long long s0 = random_state[1];
-	random_state[0] = s0;
+	unsigned long long s1 = state[0];
+	const unsigned long long s0 = state[1];
+	state[0] = s0;
 	s1 ^= s1 << 23; // a
-	random_state[1] = s1 ^ s0 ^ (s1 >> 17) ^ (s0 >> 26); // b, c
-	return random_state[1] + s0;
+	state[1] = s1 ^ s0 ^ (s1 >> 17) ^ (s0 >> 26); // b, c
+	return state[1] + s0;
+}
+
+static inline unsigned long long random64(void)
+{
+	return xorshift128p(random_state);
 }
 
 /* splitmix64 */
@@ -1393,120 +2309,3061 @@ static void random_init(void)
 	(void)random64();
 }
 
-static void random_memory(void *buf, size_t len)
-{
-	unsigned long long *ptr = buf;
-	size_t words = len >> 3;
-
-	while (words--)
-		*ptr++ = random64();
+/*
+ * Uniform random in [0, range): multiply-shift instead of slow 64-bit
+ * division, bias is below range / 2^64.
+ */
+#ifdef __SIZEOF_INT128__
+__extension__ typedef unsigned __int128 uint128_t;
+#endif
 
-	if (len & 7) {
-		unsigned long long last = random64();
-		memcpy(ptr, &last, len & 7);
-	}
+static inline unsigned long long scale_range(unsigned long long val,
+					     unsigned long long range)
+{
+#ifdef __SIZEOF_INT128__
+	return ((uint128_t)val * range) >> 64;
+#else
+	if (range <= 0xFFFFFFFFull)
+		return ((val >> 32) * range) >> 32;
+	return val % range;
+#endif
 }
 
-struct statistics {
-	long long start, finish, load_time;
-	long long count, valid, too_slow, too_fast, failed;
-	long long min, max;
-	double sum, sum2, avg, mdev;
-	double speed, iops, load_speed, load_iops;
-	long long size, load_size;
-};
+static inline unsigned long long random_range(unsigned long long range)
+{
+	return scale_range(random64(), range);
+}
 
-static void start_statistics(struct statistics *s, unsigned long long start) {
-	memset(s, 0, sizeof(*s));
-	s->min = LLONG_MAX;
-	s->max = LLONG_MIN;
-	s->start = start;
+/*
+ * Offset generators return index of next request in working set of
+ * offset_blocks requests. All are O(1) and cheap enough for timed loop.
+ */
+static off_t offset_blocks;
+static off_t offset_pos;
+static off_t offset_lane;
+static off_t offset_step;	/* stride or window */
+
+static int offset_stream;
+static off_t stream_blocks;
+static off_t *stream_pos;
+static off_t stream_size;
+static struct statistics *stream_stats;	/* for each of -streams */
+
+static off_t offset_random(void)
+{
+	return random_range(offset_blocks);
 }
 
-static int add_statistics(struct statistics *s, ssize_t ret, long long val) {
-	s->count++;
-	if (ret <= 0) {
-		s->failed++;
-	} else if (request <= warmup_request) {
-		notice = "warmup";
-	} else if (val < min_valid_time) {
-		notice = "too fast";
-		s->too_fast++;
-	} else if (val > max_valid_time) {
-		notice = "too slow";
-		s->too_slow++;
-	} else {
-		s->valid++;
-		s->sum += val;
-		s->sum2 += (double)val * val;
-		if (val < s->min)
-			s->min = val;
-		if (val > s->max)
-			s->max = val;
+static off_t offset_linear(void)
+{
+	off_t ret = offset_pos;
 
-		notice = NULL;
-		if (s->valid > 5) {
-			long long avg = s->sum / s->valid;
-			if (val * 2 < avg)
-				notice = "fast";
-			else if (val > avg * 2)
-				notice = "slow";
+	if (++offset_pos >= offset_blocks)
+		offset_pos = 0;
+	return ret;
+}
+
+static off_t offset_reverse(void)
+{
+	return offset_blocks - 1 - offset_linear();
+}
+
+/* every step-th request, then next lane */
+static off_t offset_stride(void)
+{
+	off_t ret = offset_pos;
+
+	offset_pos += offset_step;
+	if (offset_pos >= offset_blocks) {
+		if (++offset_lane >= offset_step ||
+		    offset_lane >= offset_blocks)
+			offset_lane = 0;
+		offset_pos = offset_lane;
+	}
+	return ret;
+}
+
+/* alternating ends: 0, n-1, 1, n-2, ... */
+static off_t offset_butterfly(void)
+{
+	off_t ret = offset_pos / 2;
+
+	if (offset_pos & 1)
+		ret = offset_blocks - 1 - ret;
+	if (++offset_pos >= offset_blocks)
+		offset_pos = 0;
+	return ret;
+}
+
+/* random in window which slides forward by one request */
+static off_t offset_window(void)
+{
+	off_t ret = offset_pos + random_range(offset_step);
+
+	if (++offset_pos + offset_step > offset_blocks)
+		offset_pos = 0;
+	return ret;
+}
+
+/*
+ * Random permutation: balanced Feistel network over 2^(2*half) values
+ * which covers working set, values outside are encrypted again (cycle
+ * walking), at most four rounds on average. New keys for every cycle.
+ */
+#define PERMUTE_ROUNDS	4
+
+static unsigned long long permute_key[PERMUTE_ROUNDS];
+static unsigned permute_half;
+static unsigned long long permute_mask;
+
+static void permute_init(void)
+{
+	int i;
+
+	for (i = 0; i < PERMUTE_ROUNDS; i++)
+		permute_key[i] = random64();
+}
+
+static inline unsigned long long permute(unsigned long long val)
+{
+	unsigned long long l, r, t;
+	int i;
+
+	do {
+		l = val >> permute_half;
+		r = val & permute_mask;
+		for (i = 0; i < PERMUTE_ROUNDS; i++) {
+			t = (r ^ permute_key[i]) * 0xBF58476D1CE4E5B9ull;
+			t = l ^ ((t ^ (t >> 31)) & permute_mask);
+			l = r;
+			r = t;
 		}
+		val = l << permute_half | r;
+	} while (val >= (unsigned long long)offset_blocks);
+	return val;
+}
 
-		return 1;
+static off_t offset_permute(void)
+{
+	off_t ret = permute(offset_pos);
+
+	if (++offset_pos >= offset_blocks) {
+		offset_pos = 0;
+		permute_init();
+	}
+	return ret;
+}
+
+/* sequential streams in equal regions */
+static off_t offset_streams(void)
+{
+	off_t ret;
+
+	if (stream_random)
+		offset_stream = random_range(nr_streams);
+	else
+		offset_stream = offset_lane++ % nr_streams;
+	ret = offset_stream * stream_blocks + stream_pos[offset_stream];
+	if (++stream_pos[offset_stream] >= stream_blocks)
+		stream_pos[offset_stream] = 0;
+	return ret;
+}
+
+off_t (*next_offset)(void) = offset_random;
+
+static void offset_setup(void)
+{
+	offset_blocks = wsize / size;
+	offset_pos = offset_lane = 0;
+
+	switch (offset_pattern) {
+	case PATTERN_DEFAULT:
+		next_offset = randomize ? offset_random : offset_linear;
+		break;
+	case PATTERN_RANDOM:
+		next_offset = offset_random;
+		break;
+	case PATTERN_LINEAR:
+		next_offset = offset_linear;
+		break;
+	case PATTERN_REVERSE:
+		next_offset = offset_reverse;
+		break;
+	case PATTERN_STRIDE:
+		offset_step = pattern_arg + 1;
+		next_offset = offset_stride;
+		break;
+	case PATTERN_BUTTERFLY:
+		next_offset = offset_butterfly;
+		break;
+	case PATTERN_PERMUTE:
+		for (permute_half = 0;
+		     (1ll << 2 * permute_half) < offset_blocks;
+		     permute_half++)
+			;
+		permute_mask = (1ull << permute_half) - 1;
+		permute_init();
+		next_offset = offset_permute;
+		break;
+	case PATTERN_WINDOW:
+		offset_step = pattern_arg / size;
+		if (offset_step < 1 || offset_step > offset_blocks)
+			errx(2, "window must be between request size "
+				"and working set");
+		next_offset = offset_window;
+		break;
+	}
+
+	if (nr_streams) {
+		stream_blocks = offset_blocks / nr_streams;
+		if (!stream_blocks)
+			errx(2, "working set is too small for %d streams",
+			     nr_streams);
+		stream_pos = calloc(nr_streams, sizeof(*stream_pos));
+		if (!stream_pos)
+			err(2, NULL);
+		next_offset = offset_streams;
+	}
+}
+
+static void random_memory(void *buf, size_t len)
+{
+	unsigned long long *ptr = buf;
+	size_t words = len >> 3;
+
+	while (words--)
+		*ptr++ = random64();
+
+	if (len & 7) {
+		unsigned long long last = random64();
+		memcpy(ptr, &last, len & 7);
+	}
+}
+
+/*
+ * Prepared file cache for -k: extended attribute describes prepared range
+ * and checksum of sampled blocks, thus next run validates
+ * file by reading few blocks and writes only what working set lacks.
+ * Without extended attributes file is reused if large enough and not sparse.
+ */
+#define PREPARED_XATTR		"user.ioping"
+#define PREPARED_SAMPLES	16
+#define PREPARED_SAMPLE		4096
+
+static struct prepared {
+	long long start, end;
+	unsigned long long sum;
+} prepared;
+
+static void prepare_range(void *buf, off_t from, off_t to)
+{
+	ssize_t len;
+
+	for (; from < to; from += len) {
+		len = to - from < size ? to - from : size;
+		random_memory(buf, len);
+		len = pwrite(target_fd, buf, len, from);
+		if (len <= 0)
+			err(2, "preparation write failed");
+	}
+}
+
+/* FNV-1a over aligned blocks evenly spread across prepared range */
+static int prepared_sum(struct prepared *p, unsigned long long *sum)
+{
+	long long span = p->end - p->start, pos;
+	unsigned long long word;
+	ssize_t len, i;
+	char *buf;
+	int n;
+
+	if (posix_memalign((void **)&buf, 0x1000, PREPARED_SAMPLE))
+		errx(2, "buffer allocation failed");
+
+	*sum = 0xcbf29ce484222325ull;
+	for (n = 0; n < PREPARED_SAMPLES; n++) {
+		pos = p->start + span / PREPARED_SAMPLES * n;
+		pos -= pos % PREPARED_SAMPLE;
+		len = pread(target_fd, buf, PREPARED_SAMPLE, pos);
+		if (len < 0) {
+			free(buf);
+			return -1;
+		}
+		for (i = 0; i + 8 <= len; i += 8) {
+			memcpy(&word, buf + i, 8);
+			*sum = (*sum ^ word) * 0x100000001b3ull;
+		}
 	}
 
+	free(buf);
 	return 0;
 }
 
-static void merge_statistics(struct statistics *s, struct statistics *o) {
-	s->count += o->count;
-	s->too_fast += o->too_fast;
-	s->too_slow += o->too_slow;
-	s->failed += o->failed;
-	if (o->valid) {
-		s->valid += o->valid;
-		s->sum += o->sum;
-		s->sum2 += o->sum2;
-		if (o->min < s->min)
-			s->min = o->min;
-		if (o->max > s->max)
-			s->max = o->max;
+static int prepared_load(struct prepared *p)
+{
+#ifdef HAVE_XATTR
+	char text[256];
+	ssize_t len;
+
+	len = fgetxattr(target_fd, PREPARED_XATTR, text, sizeof(text) - 1);
+	if (len < 0)
+		return -1;
+	text[len] = 0;
+	if (sscanf(text, "start=%lld end=%lld sum=%llx",
+		   &p->start, &p->end, &p->sum) != 3 ||
+	    p->start < 0 || p->end <= p->start) {
+		errno = EINVAL;
+		return -1;
 	}
+	return 0;
+#else
+	(void)p;
+	errno = ENOTSUP;
+	return -1;
+#endif
 }
 
-static void finish_statistics(struct statistics *s, unsigned long long finish) {
-	s->finish = finish;
-	s->load_time = finish - s->start;
+static void prepared_store(void)
+{
+#ifdef HAVE_XATTR
+	char text[256];
+
+	if (prepared_sum(&prepared, &prepared.sum))
+		err(2, "preparation read failed");
+	snprintf(text, sizeof(text), "start=%lld end=%lld sum=%llx",
+		 prepared.start, prepared.end, prepared.sum);
+	if (fsetxattr(target_fd, PREPARED_XATTR, text, strlen(text), 0) &&
+	    errno != ENOTSUP)
+		warn("cannot save prepared file attributes");
+#endif
+}
+
+/* returns 1 if file is prepared for working set, possibly after extending */
+static int prepared_reuse(void *buf)
+{
+	long long start = offset, end = offset + wsize;
+	unsigned long long sum;
+	struct stat st;
+
+	if (fstat(target_fd, &st))
+		err(2, "fstat failed");
+
+	if (prepared_load(&prepared)) {
+		if (errno != ENOTSUP)
+			return 0;
+		return st.st_size >= end
+#ifndef __MINGW32__
+			&& st.st_blocks >= (st.st_size + 511) / 512
+#endif
+			;
+	}
+
+	if (st.st_size < prepared.end ||
+	    prepared_sum(&prepared, &sum) || sum != prepared.sum ||
+	    end < prepared.start || start > prepared.end)
+		return 0;
+
+	if (start >= prepared.start && end <= prepared.end)
+		return 1;
+
+	if (start < prepared.start) {
+		prepare_range(buf, start, prepared.start);
+		prepared.start = start;
+	}
+	if (end > prepared.end) {
+		prepare_range(buf, prepared.end, end);
+		prepared.end = end;
+	}
+	if (fsync(target_fd))
+		err(2, "fsync failed");
+	prepared_store();
+	return 1;
+}
+
+struct cpu_usage {
+	long long time, vcsw, ivcsw, migrations;
+};
+
+#ifdef HAVE_THREAD_CPU_USAGE
+
+struct cpu_sample {
+	long long time;
+	long vcsw, ivcsw;
+	int cpu;
+};
+
+static struct cpu_sample cpu_before;
+
+static void cpu_sample(struct cpu_sample *c)
+{
+	struct timespec ts;
+	struct rusage ru;
+
+	if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts))
+		err(3, "clock_gettime failed");
+	if (getrusage(RUSAGE_THREAD, &ru))
+		err(3, "getrusage failed");
+	c->time = ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+	c->vcsw = ru.ru_nvcsw;
+	c->ivcsw = ru.ru_nivcsw;
+	c->cpu = sched_getcpu();
+}
+
+static inline void cpu_usage_start(void)
+{
+	cpu_sample(&cpu_before);
+}
+
+static inline void cpu_usage_finish(struct cpu_usage *u)
+{
+	struct cpu_sample after;
+
+	cpu_sample(&after);
+	u->time = after.time - cpu_before.time;
+	u->vcsw = after.vcsw - cpu_before.vcsw;
+	u->ivcsw = after.ivcsw - cpu_before.ivcsw;
+	u->migrations = after.cpu != cpu_before.cpu;
+}
+
+#else /* HAVE_THREAD_CPU_USAGE */
+
+static inline void cpu_usage_start(void)
+{
+}
+
+static inline void cpu_usage_finish(struct cpu_usage *u)
+{
+	memset(u, 0, sizeof(*u));
+}
+
+#endif /* HAVE_THREAD_CPU_USAGE */
+
+enum {
+	PERF_CYCLES,
+	PERF_INSTRUCTIONS,
+	PERF_CACHE_MISSES,
+	PERF_PAGE_FAULTS,
+	PERF_EVENTS,
+};
+
+static const char *perf_names[PERF_EVENTS] = {
+	"cycles",
+	"instructions",
+	"cache_misses",
+	"page_faults",
+};
+
+struct perf_usage {
+	long long count[PERF_EVENTS];
+};
+
+static int perf_available[PERF_EVENTS];
+
+#ifdef HAVE_PERF_EVENTS
+
+static const struct {
+	unsigned type;
+	unsigned long long config;
+} perf_config[PERF_EVENTS] = {
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+	{ PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS },
+};
+
+/*
+ * Hardware counters are grouped and read by single read() of leader, or
+ * without syscalls by rdpmc when mmaped page allows that. Page faults are
+ * software event, they are not in group and always need read().
+ */
+static int perf_fd[PERF_EVENTS];
+static struct perf_event_mmap_page *perf_page[PERF_EVENTS];
+static int perf_leader = -1;
+static int perf_group[PERF_EVENTS], perf_group_size;
+static int perf_rdpmc;
+static long long perf_before[PERF_EVENTS];
+
+static long perf_event_open(struct perf_event_attr *attr, pid_t pid,
+			    int cpu, int group_fd, unsigned long flags)
+{
+	return syscall(__NR_perf_event_open, attr, pid, cpu, group_fd, flags);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+static inline unsigned long long rdpmc(unsigned counter)
+{
+	unsigned low, high;
+
+	__asm__ volatile("rdpmc" : "=a" (low), "=d" (high) : "c" (counter));
+	return low | (unsigned long long)high << 32;
+}
+# define HAVE_RDPMC
+#endif
+
+static int perf_open(int event, int group_fd, int exclude_kernel)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = perf_config[event].type;
+	attr.config = perf_config[event].config;
+	attr.exclude_kernel = exclude_kernel;
+	attr.exclude_hv = 1;
+	if (group_fd < 0 && event != PERF_PAGE_FAULTS)
+		attr.read_format = PERF_FORMAT_GROUP;
+
+	return perf_event_open(&attr, 0, -1, group_fd, 0);
+}
+
+static void perf_setup(void)
+{
+	int exclude_kernel = 0;
+	int i;
+
+	for (i = 0; i < PERF_EVENTS; i++) {
+		int group_fd = i == PERF_PAGE_FAULTS ? -1 : perf_leader;
+
+		perf_fd[i] = perf_open(i, group_fd, exclude_kernel);
+		if (perf_fd[i] < 0 && (errno == EACCES || errno == EPERM) &&
+				!exclude_kernel) {
+			warnx("kernel is excluded from perf counters, "
+			      "see /proc/sys/kernel/perf_event_paranoid");
+			exclude_kernel = 1;
+			perf_fd[i] = perf_open(i, group_fd, exclude_kernel);
+		}
+		if (perf_fd[i] < 0) {
+			warn("perf counter %s is not available", perf_names[i]);
+			continue;
+		}
+		perf_available[i] = 1;
+		if (i == PERF_PAGE_FAULTS)
+			continue;
+		if (perf_leader < 0)
+			perf_leader = perf_fd[i];
+		perf_group[perf_group_size++] = i;
+	}
+
+	if (!perf_group_size && !perf_available[PERF_PAGE_FAULTS])
+		errx(2, "no perf counters available");
+
+#ifdef HAVE_RDPMC
+	perf_rdpmc = perf_group_size > 0;
+	for (i = 0; i < perf_group_size; i++) {
+		int e = perf_group[i];
+		void *page;
+
+		page = mmap(NULL, sysconf(_SC_PAGESIZE), PROT_READ,
+			    MAP_SHARED, perf_fd[e], 0);
+		if (page == MAP_FAILED) {
+			perf_rdpmc = 0;
+			continue;
+		}
+		perf_page[e] = page;
+		if (!perf_page[e]->cap_user_rdpmc)
+			perf_rdpmc = 0;
+	}
+#endif
+}
+
+#ifdef HAVE_RDPMC
+/* returns 0 if counter is not on this cpu right now */
+static inline int perf_read_page(struct perf_event_mmap_page *pc,
+				 long long *val)
+{
+	unsigned seq, idx;
+	long long count, pmc;
+
+	do {
+		seq = pc->lock;
+		__asm__ volatile("" ::: "memory");
+		idx = pc->index;
+		count = pc->offset;
+		if (!idx)
+			return 0;
+		pmc = rdpmc(idx - 1);
+		pmc <<= 64 - pc->pmc_width;
+		pmc >>= 64 - pc->pmc_width;
+		count += pmc;
+		__asm__ volatile("" ::: "memory");
+	} while (pc->lock != seq);
+
+	*val = count;
+	return 1;
+}
+#endif
+
+static void perf_read(long long *val)
+{
+	unsigned long long group[1 + PERF_EVENTS];
+	int i;
+
+	if (perf_available[PERF_PAGE_FAULTS] &&
+	    read(perf_fd[PERF_PAGE_FAULTS], &val[PERF_PAGE_FAULTS],
+		 sizeof(long long)) != sizeof(long long))
+		err(3, "perf counter read failed");
+
+#ifdef HAVE_RDPMC
+	if (perf_rdpmc) {
+		for (i = 0; i < perf_group_size; i++)
+			if (!perf_read_page(perf_page[perf_group[i]],
+					    &val[perf_group[i]]))
+				break;
+		if (i == perf_group_size)
+			return;
+	}
+#endif
+
+	if (!perf_group_size)
+		return;
+
+	if (read(perf_leader, group, sizeof(group)) < 0)
+		err(3, "perf counter read failed");
+	for (i = 0; i < perf_group_size; i++)
+		val[perf_group[i]] = group[1 + i];
+}
+
+static inline void perf_usage_start(void)
+{
+	perf_read(perf_before);
+}
+
+static inline void perf_usage_finish(struct perf_usage *u)
+{
+	int i;
+
+	perf_read(u->count);
+	for (i = 0; i < PERF_EVENTS; i++)
+		u->count[i] -= perf_before[i];
+}
+
+#else /* HAVE_PERF_EVENTS */
+
+static void perf_setup(void)
+{
+	errx(1, "perf counters not supported by this platform");
+}
+
+static inline void perf_usage_start(void)
+{
+}
+
+static inline void perf_usage_finish(struct perf_usage *u)
+{
+	memset(u, 0, sizeof(*u));
+}
+
+#endif /* HAVE_PERF_EVENTS */
+
+static int read_sysfs(const char *fmt, unsigned major, unsigned minor,
+		      char *buf, size_t len)
+{
+	char name[PATH_MAX];
+	FILE *file;
+
+	snprintf(name, sizeof(name), fmt, major, minor);
+	file = fopen(name, "r");
+	if (!file)
+		return -1;
+	if (!fgets(buf, len, file))
+		buf[0] = 0;
+	fclose(file);
+	return 0;
+}
+
+/*
+ * System state sampled at period boundaries: pressure stall information,
+ * dirty and writeback memory, reclaim and writeback counters.
+ */
+enum {
+	STALL_IO_SOME,
+	STALL_IO_FULL,
+	STALL_MEMORY_SOME,
+	STALL_MEMORY_FULL,
+	STALL_CGROUP_SOME,
+	STALL_CGROUP_FULL,
+	STALL_COUNTERS,
+};
+
+static const char *stall_names[STALL_COUNTERS] = {
+	"io_some",
+	"io_full",
+	"memory_some",
+	"memory_full",
+	"cgroup_io_some",
+	"cgroup_io_full",
+};
+
+enum {
+	VMSTAT_DIRTIED,
+	VMSTAT_WRITTEN,
+	VMSTAT_PGSCAN_DIRECT,
+	VMSTAT_ALLOCSTALL,
+	VMSTAT_COMPACT_STALL,
+	VMSTAT_PGMAJFAULT,
+	VMSTAT_COUNTERS,
+};
+
+/* allocstall is split by zones since Linux 4.10 */
+static const char *vmstat_names[VMSTAT_COUNTERS] = {
+	"nr_dirtied",
+	"nr_written",
+	"pgscan_direct",
+	"allocstall",
+	"compact_stall",
+	"pgmajfault",
+};
+
+struct pressure {
+	long long stall[STALL_COUNTERS];	/* ns */
+	long long vmstat[VMSTAT_COUNTERS];
+	long long dirty, writeback;		/* bytes, max at boundaries */
+};
+
+static int stall_available[STALL_COUNTERS];
+static char cgroup_pressure_path[PATH_MAX];
+static struct pressure pressure_before;
+
+/* directory of own cgroup in unified hierarchy */
+static int cgroup2_dir(char *buf, size_t len)
+{
+	char line[PATH_MAX + 64], mnt[PATH_MAX], type[64], cg[PATH_MAX];
+	FILE *file;
+	int found;
+
+	file = fopen("/proc/self/cgroup", "r");
+	if (!file)
+		return -1;
+	found = 0;
+	while (!found && fgets(line, sizeof(line), file))
+		found = sscanf(line, "0::%s", cg) == 1;
+	fclose(file);
+	if (!found)
+		return -1;
+
+	file = fopen("/proc/self/mounts", "r");
+	if (!file)
+		return -1;
+	found = 0;
+	while (!found && fgets(line, sizeof(line), file))
+		found = sscanf(line, "%*s %s %63s", mnt, type) == 2 &&
+			!strcmp(type, "cgroup2");
+	fclose(file);
+	if (!found)
+		return -1;
+
+	if (snprintf(buf, len, "%s%s", mnt, strcmp(cg, "/") ? cg : "") >=
+	    (int)len)
+		return -1;
+	return 0;
+}
+
+/* reads "some" and "full" stall totals, returns 0 on success */
+static int read_stall(const char *path, long long *val)
+{
+	char line[256], kind[8];
+	long long total;
+	FILE *file;
+	int ret = -1;
+
+	file = fopen(path, "r");
+	if (!file)
+		return -1;
+	while (fgets(line, sizeof(line), file)) {
+		if (sscanf(line, "%7s avg10=%*f avg60=%*f avg300=%*f total=%lld",
+			   kind, &total) != 2)
+			continue;
+		if (!strcmp(kind, "some"))
+			val[0] = total * 1000;
+		else if (!strcmp(kind, "full"))
+			val[1] = total * 1000;
+		ret = 0;
+	}
+	fclose(file);
+	return ret;
+}
+
+static void pressure_sample(struct pressure *p)
+{
+	char line[256], name[64];
+	long long val;
+	FILE *file;
+	int i;
+
+	memset(p, 0, sizeof(*p));
+
+	read_stall("/proc/pressure/io", &p->stall[STALL_IO_SOME]);
+	read_stall("/proc/pressure/memory", &p->stall[STALL_MEMORY_SOME]);
+	if (stall_available[STALL_CGROUP_SOME])
+		read_stall(cgroup_pressure_path, &p->stall[STALL_CGROUP_SOME]);
+
+	file = fopen("/proc/meminfo", "r");
+	if (file) {
+		while (fgets(line, sizeof(line), file)) {
+			if (sscanf(line, "%63[^:]: %lld", name, &val) != 2)
+				continue;
+			if (!strcmp(name, "Dirty"))
+				p->dirty = val * 1024;
+			else if (!strcmp(name, "Writeback"))
+				p->writeback = val * 1024;
+		}
+		fclose(file);
+	}
+
+	file = fopen("/proc/vmstat", "r");
+	if (file) {
+		while (fgets(line, sizeof(line), file)) {
+			if (sscanf(line, "%63s %lld", name, &val) != 2)
+				continue;
+			for (i = 0; i < VMSTAT_COUNTERS; i++) {
+				if (!strcmp(name, vmstat_names[i]) ||
+				    (i == VMSTAT_ALLOCSTALL &&
+				     !strncmp(name, "allocstall_", 11)))
+					p->vmstat[i] += val;
+			}
+		}
+		fclose(file);
+	}
+}
+
+static void pressure_setup(void)
+{
+	long long stall[2];
+	char dir[PATH_MAX];
+	int i;
+
+	if (!read_stall("/proc/pressure/io", stall))
+		stall_available[STALL_IO_SOME] =
+			stall_available[STALL_IO_FULL] = 1;
+	if (!read_stall("/proc/pressure/memory", stall))
+		stall_available[STALL_MEMORY_SOME] =
+			stall_available[STALL_MEMORY_FULL] = 1;
+	if (!cgroup2_dir(dir, sizeof(dir)) &&
+	    snprintf(cgroup_pressure_path, sizeof(cgroup_pressure_path),
+		     "%s/io.pressure", dir) < (int)sizeof(cgroup_pressure_path) &&
+	    !read_stall(cgroup_pressure_path, stall))
+		stall_available[STALL_CGROUP_SOME] =
+			stall_available[STALL_CGROUP_FULL] = 1;
+
+	for (i = 0; i < STALL_COUNTERS; i++)
+		if (stall_available[i])
+			break;
+	if (i == STALL_COUNTERS)
+		warnx("pressure stall information is not available");
+
+	pressure_sample(&pressure_before);
+}
+
+/* deltas since previous call */
+static void pressure_update(struct pressure *p)
+{
+	struct pressure after;
+	int i;
+
+	pressure_sample(&after);
+	for (i = 0; i < STALL_COUNTERS; i++)
+		p->stall[i] += after.stall[i] - pressure_before.stall[i];
+	for (i = 0; i < VMSTAT_COUNTERS; i++)
+		p->vmstat[i] += after.vmstat[i] - pressure_before.vmstat[i];
+	p->dirty = after.dirty;
+	p->writeback = after.writeback;
+	pressure_before = after;
+}
+
+/*
+ * Dedicated child cgroup v2 with given io.* settings: ioping moves itself
+ * into it at start and back at exit. Counters from io.stat for target disk
+ * are reported per period, -cgroup-weights rotates io.weight every period.
+ */
+enum {
+	CGROUP_RBYTES,
+	CGROUP_WBYTES,
+	CGROUP_RIOS,
+	CGROUP_WIOS,
+	CGROUP_COST_WAIT,
+	CGROUP_COST_INDELAY,
+	CGROUP_DELAY,
+	CGROUP_COUNTERS,
+};
+
+static const char *cgroup_names[CGROUP_COUNTERS] = {
+	"rbytes",
+	"wbytes",
+	"rios",
+	"wios",
+	"cost.wait",
+	"cost.indelay",
+	"delay_nsec",
+};
+
+/* iocost debug stats are in us */
+static const int cgroup_scale[CGROUP_COUNTERS] = { 1, 1, 1, 1, 1000, 1000, 1 };
+
+struct cgroup_io {
+	long long stat[CGROUP_COUNTERS];
+};
+
+static int cgroup_available[CGROUP_COUNTERS];
+static int cgroup_weight;
+static struct statistics *weight_stats;	/* for each of -cgroup-weights */
+
+#ifdef HAVE_CGROUP
+
+static char cgroup_parent[PATH_MAX];
+static char cgroup_dir[PATH_MAX];
+static int cgroup_enabled_io;
+static unsigned cgroup_major, cgroup_minor;
+static struct cgroup_io cgroup_before;
+
+static int cgroup_read(const char *dir, const char *name, char *buf, size_t len)
+{
+	char path[PATH_MAX];
+	FILE *file;
+
+	if (snprintf(path, sizeof(path), "%s/%s", dir, name) >=
+	    (int)sizeof(path))
+		return -1;
+	file = fopen(path, "r");
+	if (!file)
+		return -1;
+	if (!fgets(buf, len, file))
+		buf[0] = 0;
+	fclose(file);
+	return 0;
+}
+
+static int cgroup_try_write(const char *dir, const char *name,
+			    const char *value)
+{
+	char path[PATH_MAX];
+	ssize_t len = strlen(value);
+	int fd, ret = 0;
+
+	if (snprintf(path, sizeof(path), "%s/%s", dir, name) >=
+	    (int)sizeof(path))
+		errx(2, "cgroup path is too long");
+	fd = open(path, O_WRONLY);
+	if (fd < 0)
+		return -1;
+	if (write(fd, value, len) != len)
+		ret = -1;
+	if (close(fd))
+		ret = -1;
+	return ret;
+}
+
+static void cgroup_write(const char *dir, const char *name, const char *value)
+{
+	if (cgroup_try_write(dir, name, value))
+		err(2, "failed to write \"%s\" into \"%s/%s\"",
+		    value, dir, name);
+}
+
+static int has_word(const char *list, const char *word)
+{
+	size_t len = strlen(word);
+	const char *ptr;
+
+	for (ptr = strstr(list, word); ptr; ptr = strstr(ptr + 1, word))
+		if ((ptr == list || ptr[-1] == ' ') &&
+		    (!ptr[len] || ptr[len] == ' ' || ptr[len] == '\n'))
+			return 1;
+	return 0;
+}
+
+static void cgroup_sample(struct cgroup_io *c)
+{
+	char path[PATH_MAX], line[1024], *tok, *val;
+	unsigned major, minor;
+	FILE *file;
+	int i, n;
+
+	memset(c, 0, sizeof(*c));
+	if (snprintf(path, sizeof(path), "%s/io.stat", cgroup_dir) >=
+	    (int)sizeof(path))
+		errx(3, "cgroup path is too long");
+	file = fopen(path, "r");
+	if (!file)
+		err(3, "failed to read \"%s\"", path);
+	while (fgets(line, sizeof(line), file)) {
+		if (sscanf(line, "%u:%u %n", &major, &minor, &n) != 2 ||
+		    major != cgroup_major || minor != cgroup_minor)
+			continue;
+		for (tok = strtok(line + n, " \n"); tok;
+		     tok = strtok(NULL, " \n")) {
+			val = strchr(tok, '=');
+			if (!val)
+				continue;
+			*val++ = 0;
+			for (i = 0; i < CGROUP_COUNTERS; i++) {
+				if (strcmp(tok, cgroup_names[i]))
+					continue;
+				c->stat[i] = atoll(val) * cgroup_scale[i];
+				cgroup_available[i] = 1;
+			}
+		}
+	}
+	fclose(file);
+}
+
+static void cgroup_update(struct cgroup_io *c)
+{
+	struct cgroup_io after;
+	int i;
+
+	cgroup_sample(&after);
+	for (i = 0; i < CGROUP_COUNTERS; i++)
+		c->stat[i] += after.stat[i] - cgroup_before.stat[i];
+	cgroup_before = after;
+}
+
+static void cgroup_set_weight(int index)
+{
+	char buf[32];
+
+	cgroup_weight = index;
+	snprintf(buf, sizeof(buf), "%u", cgroup_weights[index]);
+	cgroup_write(cgroup_dir, "io.weight", buf);
+}
+
+static void cgroup_next_weight(void)
+{
+	cgroup_set_weight((cgroup_weight + 1) % nr_cgroup_weights);
+}
+
+static void cgroup_cleanup(void)
+{
+	char buf[32];
+
+	/* parent with enabled controllers cannot take process back */
+	if (cgroup_enabled_io &&
+	    cgroup_try_write(cgroup_parent, "cgroup.subtree_control", "-io"))
+		warn("failed to disable io controller in \"%s\"",
+		     cgroup_parent);
+	snprintf(buf, sizeof(buf), "%d", (int)getpid());
+	if (cgroup_try_write(cgroup_parent, "cgroup.procs", buf))
+		warn("failed to leave cgroup \"%s\"", cgroup_dir);
+	else if (rmdir(cgroup_dir))
+		warn("failed to remove cgroup \"%s\"", cgroup_dir);
+}
+
+static void cgroup_setup(dev_t dev)
+{
+	char buf[PATH_MAX], *settings, *key, *val, *next;
+
+	if (cgroup2_dir(cgroup_parent, sizeof(cgroup_parent)))
+		errx(2, "cgroup v2 hierarchy not found");
+
+	if (cgroup_read(cgroup_parent, "cgroup.controllers", buf, sizeof(buf)) ||
+	    !has_word(buf, "io"))
+		errx(2, "io controller is not available in cgroup \"%s\"",
+		     cgroup_parent);
+
+	if (snprintf(cgroup_dir, sizeof(cgroup_dir), "%s/ioping.%d",
+		     cgroup_parent, (int)getpid()) >= (int)sizeof(cgroup_dir))
+		errx(2, "cgroup path is too long");
+	if (mkdir(cgroup_dir, 0755))
+		err(2, "failed to create cgroup \"%s\"", cgroup_dir);
+	atexit(cgroup_cleanup);
+
+	/*
+	 * Non-root cgroup cannot have both processes and enabled controllers,
+	 * thus leave own cgroup before enabling io controller for children.
+	 */
+	snprintf(buf, sizeof(buf), "%d", (int)getpid());
+	cgroup_write(cgroup_dir, "cgroup.procs", buf);
+
+	if (cgroup_read(cgroup_parent, "cgroup.subtree_control",
+			buf, sizeof(buf)) || !has_word(buf, "io")) {
+		if (cgroup_try_write(cgroup_parent, "cgroup.subtree_control",
+				     "+io")) {
+			if (errno == EBUSY)
+				errx(2, "cgroup \"%s\" has other processes, "
+				     "run ioping alone in delegated cgroup, "
+				     "for example as root: systemd-run --scope "
+				     "-p Delegate=yes ioping ...",
+				     cgroup_parent);
+			err(2, "failed to enable io controller in \"%s\"",
+			    cgroup_parent);
+		}
+		cgroup_enabled_io = 1;
+	}
+
+	/* io controller works with whole disks */
+	cgroup_major = major(dev);
+	cgroup_minor = minor(dev);
+	if (!read_sysfs("/sys/dev/block/%u:%u/partition",
+			cgroup_major, cgroup_minor, buf, sizeof(buf)) &&
+	    (read_sysfs("/sys/dev/block/%u:%u/../dev",
+			cgroup_major, cgroup_minor, buf, sizeof(buf)) ||
+	     sscanf(buf, "%u:%u", &cgroup_major, &cgroup_minor) != 2))
+		errx(2, "failed to find whole disk of partition");
+
+	settings = strdup(cgroup_settings);
+	if (!settings)
+		err(2, NULL);
+	for (key = settings; key && *key; key = next) {
+		unsigned major, minor;
+
+		next = strchr(key, ';');
+		if (next)
+			*next++ = 0;
+		val = strchr(key, '=');
+		if (!val || val == key || strchr(key, '/'))
+			errx(1, "invalid cgroup setting: \"%s\"", key);
+		*val++ = 0;
+		/* limits are per device, default is target disk */
+		if ((!strcmp(key, "io.max") || !strcmp(key, "io.latency")) &&
+		    sscanf(val, "%u:%u", &major, &minor) != 2) {
+			snprintf(buf, sizeof(buf), "%u:%u %s",
+				 cgroup_major, cgroup_minor, val);
+			val = buf;
+		}
+		cgroup_write(cgroup_dir, key, val);
+	}
+	free(settings);
+
+	if (nr_cgroup_weights)
+		cgroup_set_weight(0);
+
+	/* disk line appears after first request */
+	cgroup_available[CGROUP_RBYTES] = cgroup_available[CGROUP_WBYTES] = 1;
+	cgroup_available[CGROUP_RIOS] = cgroup_available[CGROUP_WIOS] = 1;
+	cgroup_sample(&cgroup_before);
+}
+
+#else /* HAVE_CGROUP */
+
+static void cgroup_setup(dev_t dev)
+{
+	(void)dev;
+	errx(1, "cgroup not supported by this platform");
+}
+
+static void cgroup_update(struct cgroup_io *c)
+{
+	(void)c;
+}
+
+static void cgroup_next_weight(void)
+{
+}
+
+#endif /* HAVE_CGROUP */
+
+/*
+ * Log-linear latency histogram: values below 2^HIST_SUB_BITS have exact
+ * buckets, above that every power of two is split into HIST_SUB buckets,
+ * thus relative error is below 1/HIST_SUB.
+ */
+#define HIST_SUB_BITS	5
+#define HIST_SUB	(1 << HIST_SUB_BITS)
+#define HIST_SIZE	((64 - HIST_SUB_BITS + 1) * HIST_SUB)
+
+static inline int ilog2(unsigned long long val)
+{
+#ifdef __GNUC__
+	return 63 - __builtin_clzll(val);
+#else
+	int ret = 0;
+
+	while (val >>= 1)
+		ret++;
+	return ret;
+#endif
+}
+
+static inline int hist_index(unsigned long long val)
+{
+	int shift;
+
+	if (val < HIST_SUB)
+		return val;
+	shift = ilog2(val) - HIST_SUB_BITS;
+	return ((shift + 1) << HIST_SUB_BITS) + (val >> shift) - HIST_SUB;
+}
+
+static inline long long hist_lower(int index)
+{
+	int shift = (index >> HIST_SUB_BITS) - 1;
+
+	if (shift < 0)
+		return index;
+	return (long long)(HIST_SUB + (index & (HIST_SUB - 1))) << shift;
+}
+
+static inline long long hist_upper(int index)
+{
+	int shift = (index >> HIST_SUB_BITS) - 1;
+
+	if (shift < 0)
+		return index + 1;
+	return hist_lower(index) + (1ll << shift);
+}
+
+struct statistics {
+	long long start, finish, load_time;
+	long long count, valid, too_slow, too_fast, failed;
+	long long min, max;
+	double sum, sum2, avg, mdev;
+	double speed, iops, load_speed, load_iops;
+	long long size, load_size;
+	struct cpu_usage cpu;	/* for all requests */
+	struct perf_usage perf;	/* for all requests */
+	struct pressure pressure;
+	struct cgroup_io cgroup;
+	unsigned long long hist[HIST_SIZE];
+};
+
+static void start_statistics(struct statistics *s, unsigned long long start) {
+	memset(s, 0, sizeof(*s));
+	s->min = LLONG_MAX;
+	s->max = LLONG_MIN;
+	s->start = start;
+}
+
+static inline void add_valid(struct statistics *s, long long val)
+{
+	s->valid++;
+	s->sum += val;
+	s->sum2 += (double)val * val;
+	s->hist[hist_index(val)]++;
+	if (val < s->min)
+		s->min = val;
+	if (val > s->max)
+		s->max = val;
+}
+
+static int add_statistics(struct statistics *s, ssize_t ret, long long val) {
+	s->count++;
+	if (ret <= 0) {
+		s->failed++;
+	} else if (request <= warmup_request) {
+		notice = "warmup";
+	} else if (val < min_valid_time) {
+		notice = "too fast";
+		s->too_fast++;
+	} else if (val > max_valid_time) {
+		notice = "too slow";
+		s->too_slow++;
+	} else {
+		add_valid(s, val);
+
+		notice = NULL;
+		if (s->valid > 5) {
+			long long avg = s->sum / s->valid;
+			if (val * 2 < avg)
+				notice = "fast";
+			else if (val > avg * 2)
+				notice = "slow";
+		}
+
+		return 1;
+	}
+
+	return 0;
+}
+
+static void add_cpu_usage(struct statistics *s, struct cpu_usage *u)
+{
+	s->cpu.time += u->time;
+	s->cpu.vcsw += u->vcsw;
+	s->cpu.ivcsw += u->ivcsw;
+	s->cpu.migrations += u->migrations;
+}
+
+static void add_perf_usage(struct statistics *s, struct perf_usage *u)
+{
+	int i;
+
+	for (i = 0; i < PERF_EVENTS; i++)
+		s->perf.count[i] += u->count[i];
+}
+
+static void add_pressure(struct statistics *s, struct pressure *p)
+{
+	int i;
+
+	for (i = 0; i < STALL_COUNTERS; i++)
+		s->pressure.stall[i] += p->stall[i];
+	for (i = 0; i < VMSTAT_COUNTERS; i++)
+		s->pressure.vmstat[i] += p->vmstat[i];
+	if (p->dirty > s->pressure.dirty)
+		s->pressure.dirty = p->dirty;
+	if (p->writeback > s->pressure.writeback)
+		s->pressure.writeback = p->writeback;
+}
+
+static void merge_statistics(struct statistics *s, struct statistics *o) {
+	int i;
+
+	add_cpu_usage(s, &o->cpu);
+	add_perf_usage(s, &o->perf);
+	add_pressure(s, &o->pressure);
+	for (i = 0; i < CGROUP_COUNTERS; i++)
+		s->cgroup.stat[i] += o->cgroup.stat[i];
+	s->count += o->count;
+	s->too_fast += o->too_fast;
+	s->too_slow += o->too_slow;
+	s->failed += o->failed;
+	if (o->valid) {
+		s->valid += o->valid;
+		s->sum += o->sum;
+		s->sum2 += o->sum2;
+		if (o->min < s->min)
+			s->min = o->min;
+		if (o->max > s->max)
+			s->max = o->max;
+		for (i = 0; i < HIST_SIZE; i++)
+			s->hist[i] += o->hist[i];
+	}
+}
+
+static void finish_statistics(struct statistics *s, unsigned long long finish) {
+	s->finish = finish;
+	s->load_time = finish - s->start;
+
+	if (s->valid) {
+		s->avg = s->sum / s->valid;
+		s->mdev = sqrt(s->sum2 / s->valid - s->avg * s->avg);
+	} else {
+		s->min = 0;
+		s->max = 0;
+	}
+
+	if (s->sum)
+		s->iops = (double)NSEC_PER_SEC * s->valid / s->sum;
+
+	if (s->load_time)
+		s->load_iops = (double)NSEC_PER_SEC * s->count / s->load_time;
+
+	s->speed = s->iops * size;
+	s->load_speed = s->load_iops * size;
+	s->size = s->valid * size;
+	s->load_size = s->count * size;
+}
+
+/*
+ * Arrival processes for request issue times, all keep average rate of
+ * -i or -r. Two-state model: dwell time in each state is exponential,
+ * inter-arrivals within state are exponential with state's rate, thus
+ * "exp" is Poisson process, "onoff" has zero rate when off and "mmpp"
+ * is Markov-modulated Poisson process with high and low rates.
+ */
+static unsigned long long arrival_random[2];
+static double arrival_scale[2];		/* interval multiplier, 0 - off */
+static double arrival_dwell[2];		/* mean state time, ns */
+static int arrival_state;
+static long long arrival_left;		/* time till state change */
+static struct statistics arrival_stats;	/* issue time after arrival */
+
+static inline double arrival_exp(double mean)
+{
+	double u = (xorshift128p(arrival_random) >> 11) * 0x1.0p-53;
+
+	return -log1p(-u) * mean;
+}
+
+static void arrival_setup(void)
+{
+	double p;
+	int i;
+
+	arrival_random[0] = random64_seed();
+	arrival_random[1] = random64_seed();
+
+	for (i = 0; i < 2; i++)
+		arrival_dwell[i] = arrival_time[i];
+	p = arrival_dwell[0] / (arrival_dwell[0] + arrival_dwell[1]);
+
+	switch (arrival) {
+	case ARRIVAL_EXP:
+		arrival_scale[0] = arrival_scale[1] = 1;
+		break;
+	case ARRIVAL_ONOFF:
+		/* state 0 is on */
+		arrival_scale[0] = p;
+		arrival_scale[1] = 0;
+		break;
+	case ARRIVAL_MMPP:
+		/* state 0 is high */
+		arrival_scale[1] = p * arrival_ratio + (1 - p);
+		arrival_scale[0] = arrival_scale[1] / arrival_ratio;
+		break;
+	}
+
+	arrival_state = 0;
+	arrival_left = arrival_exp(arrival_dwell[0]);
+}
+
+/* time till next arrival with given mean interval */
+static long long arrival_interval(long long mean)
+{
+	long long gap, time = 0;
+
+	while (1) {
+		if (arrival_scale[arrival_state]) {
+			gap = arrival_exp(mean * arrival_scale[arrival_state]);
+			if (gap < arrival_left) {
+				arrival_left -= gap;
+				return time + gap;
+			}
+		}
+		time += arrival_left;
+		arrival_state ^= 1;
+		arrival_left = arrival_exp(arrival_dwell[arrival_state]);
+	}
+}
+
+/*
+ * Buffered write is throttled in balance_dirty_pages() when dirty and
+ * writeback memory is above freerun ceiling: midway between background
+ * and foreground dirty thresholds. Writes slower than -throttle time are
+ * checked against it before and after request: pause lets writeback catch
+ * up. Others are a plain copy into page cache. /proc/vmstat is read out of
+ * timed window: before request and after its time is taken.
+ */
+static struct statistics throttle_stats;
+static long long throttle_slow;
+static int throttle_before;
+
+/* returns 1 if above freerun ceiling, -1 if unknown */
+static int dirty_throttled(void)
+{
+	long long dirty = -1, writeback = -1, thresh = -1, bg_thresh = -1;
+	char line[256], name[64];
+	long long val;
+	FILE *file;
+
+	file = fopen("/proc/vmstat", "r");
+	if (!file)
+		return -1;
+	while (fgets(line, sizeof(line), file)) {
+		if (sscanf(line, "%63s %lld", name, &val) != 2)
+			continue;
+		if (!strcmp(name, "nr_dirty"))
+			dirty = val;
+		else if (!strcmp(name, "nr_writeback"))
+			writeback = val;
+		else if (!strcmp(name, "nr_dirty_threshold"))
+			thresh = val;
+		else if (!strcmp(name, "nr_dirty_background_threshold"))
+			bg_thresh = val;
+	}
+	fclose(file);
+
+	if (dirty < 0 || writeback < 0 || thresh < 0 || bg_thresh < 0)
+		return -1;
+	return dirty + writeback >= (thresh + bg_thresh) / 2;
+}
+
+static void add_throttle(long long val)
+{
+	if (val < throttle_threshold)
+		return;
+	if (throttle_before > 0 || dirty_throttled() > 0) {
+		add_valid(&throttle_stats, val);
+		notice = "throttled";
+	} else
+		throttle_slow++;
+}
+
+/*
+ * Allocating writes: temporary file is left sparse or preallocated with
+ * unwritten extents instead of being filled, thus first write into each
+ * request of working set allocates blocks or converts extent and later
+ * writes overwrite them. Copy-on-write filesystems allocate at every write,
+ * there the difference shows extra cost of growing extent tree.
+ */
+#define BITS_PER_LONG	(8 * sizeof(unsigned long))
+
+static struct statistics allocating_stats;
+static struct statistics overwrite_stats;
+static unsigned long *allocated;
+static int allocating;
+
+static void allocate_setup(void)
+{
+	off_t blocks = (wsize + size - 1) / size;
+
+	allocated = calloc((blocks + BITS_PER_LONG - 1) / BITS_PER_LONG,
+			   sizeof(*allocated));
+	if (!allocated)
+		err(2, NULL);
+
+	if (ftruncate(target_fd, offset + wsize))
+		err(2, "ftruncate failed");
+
+#ifdef HAVE_FALLOCATE
+	if (allocate == ALLOCATE_UNWRITTEN &&
+	    fallocate(target_fd, 0, offset, wsize))
+		err(2, "fallocate failed, please retry with -allocate sparse");
+#endif
+}
+
+/* returns 1 for first write into request at this offset */
+static int allocate_request(off_t off)
+{
+	off_t bit = off / size;
+	unsigned long *word = &allocated[bit / BITS_PER_LONG];
+	unsigned long mask = 1ul << (bit % BITS_PER_LONG);
+
+	if (*word & mask)
+		return 0;
+	*word |= mask;
+	return 1;
+}
+
+static void add_allocate(long long val)
+{
+	if (allocating) {
+		add_valid(&allocating_stats, val);
+		if (!notice)
+			notice = "allocating";
+	} else
+		add_valid(&overwrite_stats, val);
+}
+
+/*
+ * Preconditioning: sequential passes of PRECONDITION_CHUNK writes, then
+ * rounds of random writes until steady_state() holds for last
+ * PRECONDITION_WINDOW rounds or PRECONDITION_ROUNDS are done.
+ */
+#define PRECONDITION_CHUNK	(1 << 20)
+#define PRECONDITION_WINDOW	5
+#define PRECONDITION_ROUNDS	25
+
+static double precondition_iops[PRECONDITION_ROUNDS];
+static double precondition_avg[PRECONDITION_ROUNDS];
+static int precondition_rounds;
+static int precondition_steady;
+static unsigned long long precondition_random[2];
+static int precondition_flags = -1;	/* saved file flags if O_DIRECT set */
+
+static int steady_state(double *y, int n)
+{
+	double avg = 0, min = y[0], max = y[0], sxy = 0, sxx = 0, x;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		avg += y[i];
+		if (y[i] < min)
+			min = y[i];
+		if (y[i] > max)
+			max = y[i];
+	}
+	avg /= n;
+	if (avg <= 0)
+		return 0;
+
+	for (i = 0; i < n; i++) {
+		x = i - (n - 1) / 2.0;
+		sxy += x * (y[i] - avg);
+		sxx += x * x;
+	}
+
+	return max - min <= 0.2 * avg &&
+	       fabs(sxy / sxx) * (n - 1) <= 0.1 * avg;
+}
+
+static void precondition_random_setup(void)
+{
+	precondition_random[0] = random64_seed();
+	precondition_random[1] = random64_seed();
+}
+
+/* switch to direct I/O for writes, buffered I/O is fallback */
+static void precondition_direct(int enable)
+{
+#ifdef HAVE_DIRECT_IO
+	if (direct)
+		return;
+	if (enable) {
+		precondition_flags = fcntl(target_fd, F_GETFL);
+		if (precondition_flags < 0 ||
+		    fcntl(target_fd, F_SETFL, precondition_flags | O_DIRECT))
+			precondition_flags = -1;
+	} else if (precondition_flags >= 0) {
+		if (fcntl(target_fd, F_SETFL, precondition_flags))
+			err(2, "fcntl(F_SETFL) failed");
+		precondition_flags = -1;
+	}
+#else
+	(void)enable;
+#endif
+}
+
+static void precondition_write(void *buf, size_t len, off_t pos)
+{
+	ssize_t ret = pwrite(target_fd, buf, len, offset + pos);
+
+	/* size or offset not aligned for direct I/O */
+	if (ret < 0 && errno == EINVAL && precondition_flags >= 0) {
+		precondition_direct(0);
+		ret = pwrite(target_fd, buf, len, offset + pos);
+	}
+	if (ret != (ssize_t)len)
+		err(2, "precondition write failed");
+}
+
+static void run_precondition(void)
+{
+	off_t end = wsize / size * size, pos;
+	ssize_t chunk = PRECONDITION_CHUNK, len, i;
+	unsigned long long *ptr;
+	struct statistics round;
+	long long start, round_end, time_now;
+	void *buf;
+	int pass, first;
+
+	if (chunk < size)
+		chunk = size;
+	chunk = chunk / size * size;
+	if (chunk > end)
+		chunk = end;
+
+	if (posix_memalign(&buf, 0x1000, chunk + 8))
+		errx(2, "buffer allocation failed");
+	precondition_random_setup();
+	for (ptr = buf, i = 0; i < (chunk + 7) / 8; i++)
+		ptr[i] = xorshift128p(precondition_random);
+
+	precondition_direct(1);
+
+	for (pass = 0; pass < precondition_passes && !exiting; pass++) {
+		for (pos = 0; pos < end && !exiting; pos += len) {
+			len = end - pos < chunk ? end - pos : chunk;
+			precondition_write(buf, len, pos);
+		}
+		if (fsync(target_fd))
+			err(2, "fsync failed");
+	}
+
+	while (precondition_rounds < PRECONDITION_ROUNDS && !exiting) {
+		time_now = now();
+		round_end = time_now + precondition_round;
+		start_statistics(&round, time_now);
+		do {
+			pos = scale_range(xorshift128p(precondition_random),
+					  end / size) * size;
+			start = now();
+			precondition_write(buf, size, pos);
+			time_now = now();
+			round.count++;
+			add_valid(&round, time_now - start);
+		} while (time_now < round_end && !exiting);
+		/* flush is part of round throughput, not request latency */
+		if (fsync(target_fd))
+			err(2, "fsync failed");
+		finish_statistics(&round, now());
+
+		precondition_iops[precondition_rounds] = round.load_iops;
+		precondition_avg[precondition_rounds] = round.avg;
+		precondition_rounds++;
+
+		if (!quiet && !json) {
+			printf("precondition round %d: ", precondition_rounds);
+			print_int(round.load_iops);
+			printf(" iops, avg ");
+			print_time(round.avg);
+			printf("\n");
+			fflush(stdout);
+		}
+
+		first = precondition_rounds - PRECONDITION_WINDOW;
+		if (first >= 0 &&
+		    steady_state(precondition_iops + first,
+				 PRECONDITION_WINDOW) &&
+		    steady_state(precondition_avg + first,
+				 PRECONDITION_WINDOW)) {
+			precondition_steady = 1;
+			break;
+		}
+	}
+
+	precondition_direct(0);
+	if (fsync(target_fd))
+		err(2, "fsync failed");
+	free(buf);
+
+	if (!precondition_steady && !exiting)
+		warnx("steady state not reached in %d rounds",
+		      precondition_rounds);
+}
+
+/* average over steady state window or all rounds */
+static double precondition_mean(double *y)
+{
+	int i, first = 0;
+	double sum = 0;
+
+	if (precondition_steady)
+		first = precondition_rounds - PRECONDITION_WINDOW;
+	for (i = first; i < precondition_rounds; i++)
+		sum += y[i];
+	return i > first ? sum / (i - first) : 0;
+}
+
+/*
+ * Zoned block devices: sequential zones accept writes only at write pointer.
+ * Each request picks random zone of working set, refreshes its state with
+ * BLKREPORTZONE and writes at write pointer, or with "append" sends NVMe
+ * Zone Append to zone start and device chooses location. Zone without room
+ * for request is reset, with "finish" it is finished before reset or when
+ * given size is written, with "open" empty zone is explicitly opened. These
+ * commands are timed separately, writes are classified by zone condition.
+ */
+enum {
+	ZONE_EMPTY,
+	ZONE_IMP_OPEN,
+	ZONE_EXP_OPEN,
+	ZONE_CLOSED,
+	ZONE_OPEN,
+	ZONE_FINISH,
+	ZONE_RESET,
+	ZONE_STATS,
+};
+
+static const char *zone_names[ZONE_STATS] = {
+	"empty",
+	"implicit_open",
+	"explicit_open",
+	"closed",
+	"open",
+	"finish",
+	"reset",
+};
+
+static struct statistics zone_stats[ZONE_STATS];
+static int zone_cond = -1;
+static int nr_zones;
+
+#ifdef HAVE_ZONED
+
+#define ZONE_REPORT	1024
+
+struct zone {
+	off_t start, len, capacity, wp;
+	int cond;
+};
+
+static struct zone *zones;
+static struct zone *zone;
+
+static void zone_update(struct zone *z, struct blk_zone *b, unsigned flags)
+{
+	z->start = b->start << 9;
+	z->len = b->len << 9;
+#ifdef HAVE_ZONE_CAPACITY
+	z->capacity = (flags & BLK_ZONE_REP_CAPACITY ? b->capacity : b->len) << 9;
+#else
+	(void)flags;
+	z->capacity = z->len;
+#endif
+	z->wp = b->wp << 9;
+	z->cond = b->cond;
+}
+
+static void zone_report(struct zone *z)
+{
+	union {
+		struct blk_zone_report rep;
+		char buf[sizeof(struct blk_zone_report) +
+			 sizeof(struct blk_zone)];
+	} r;
+
+	memset(&r, 0, sizeof(r));
+	r.rep.sector = z->start >> 9;
+	r.rep.nr_zones = 1;
+	if (ioctl(target_fd, BLKREPORTZONE, &r.rep) || r.rep.nr_zones != 1)
+		err(3, "zone report failed");
+	zone_update(z, &r.rep.zones[0], r.rep.flags);
+}
+
+static void zone_command(struct zone *z, unsigned long cmd, int stat)
+{
+	struct blk_zone_range range = { z->start >> 9, z->len >> 9 };
+	long long start = now();
+
+	if (ioctl(target_fd, cmd, &range))
+		err(3, "zone %s failed", zone_names[stat]);
+	zone_stats[stat].count++;
+	add_valid(&zone_stats[stat], now() - start);
+}
+
+#ifdef HAVE_NVME_IOCTL
+#define NVME_ZONE_APPEND	0x7d
+
+static int zone_lba, zone_nsid;
+
+static ssize_t zone_append_write(int fd, void *buf, size_t nbytes, off_t off)
+{
+	unsigned long long zslba = zone->start / zone_lba;
+	struct nvme_passthru_cmd cmd;
+	int ret;
+
+	(void)off;
+	memset(&cmd, 0, sizeof(cmd));
+	cmd.opcode = NVME_ZONE_APPEND;
+	cmd.nsid = zone_nsid;
+	cmd.addr = (unsigned long)buf;
+	cmd.data_len = nbytes;
+	cmd.cdw10 = zslba;
+	cmd.cdw11 = zslba >> 32;
+	cmd.cdw12 = nbytes / zone_lba - 1;
+	ret = ioctl(fd, NVME_IOCTL_IO_CMD, &cmd);
+	if (ret > 0)
+		errno = EIO;
+	return ret ? -1 : (ssize_t)nbytes;
+}
+#endif /* HAVE_NVME_IOCTL */
+
+static void zone_setup(void)
+{
+	unsigned long long sector = offset >> 9;
+	unsigned long long end = (offset + wsize) >> 9;
+	struct blk_zone_report *rep;
+	struct blk_zone *b;
+	unsigned i;
+
+	rep = malloc(sizeof(*rep) + ZONE_REPORT * sizeof(rep->zones[0]));
+	if (!rep)
+		err(2, NULL);
+
+	while (sector < end) {
+		memset(rep, 0, sizeof(*rep));
+		rep->sector = sector;
+		rep->nr_zones = ZONE_REPORT;
+		if (ioctl(target_fd, BLKREPORTZONE, rep)) {
+			if (errno == ENOTTY || errno == EOPNOTSUPP)
+				errx(2, "not a zoned block device");
+			err(2, "zone report failed");
+		}
+		if (!rep->nr_zones)
+			break;
+		for (i = 0; i < rep->nr_zones; i++) {
+			b = &rep->zones[i];
+			sector = b->start + b->len;
+			if (b->start < (unsigned long long)offset >> 9 ||
+			    sector > end ||
+			    b->type == BLK_ZONE_TYPE_CONVENTIONAL ||
+			    b->cond == BLK_ZONE_COND_READONLY ||
+			    b->cond == BLK_ZONE_COND_OFFLINE)
+				continue;
+			if (!(nr_zones & (ZONE_REPORT - 1))) {
+				zones = realloc(zones, (nr_zones + ZONE_REPORT) *
+						sizeof(*zones));
+				if (!zones)
+					err(2, NULL);
+			}
+			zone_update(&zones[nr_zones++], b, rep->flags);
+		}
+	}
+	free(rep);
+
+	if (!nr_zones)
+		errx(2, "no sequential zones in working set");
+	for (i = 0; i < (unsigned)nr_zones; i++)
+		if (zones[i].capacity < size)
+			errx(2, "request size is too big for zone");
+
+#ifdef HAVE_NVME_IOCTL
+	if (zone_append) {
+		zone_nsid = ioctl(target_fd, NVME_IOCTL_ID);
+		if (zone_nsid <= 0)
+			err(2, "zone append requires NVMe namespace");
+		if (ioctl(target_fd, BLKSSZGET, &zone_lba))
+			err(2, "logical block size ioctl failed");
+		if (size % zone_lba)
+			errx(2, "request size must be multiple of %d", zone_lba);
+		make_request = zone_append_write;
+	}
+#endif
+}
+
+/* returns offset of next write, handles full zones */
+static off_t zone_next(void)
+{
+	zone = &zones[random_range(nr_zones)];
+	zone_report(zone);
+
+	if (zone_finish && zone->cond != BLK_ZONE_COND_EMPTY &&
+	    zone->cond != BLK_ZONE_COND_FULL &&
+	    (zone->wp - zone->start >= zone_finish ||
+	     zone->wp + size > zone->start + zone->capacity)) {
+		zone_command(zone, BLKFINISHZONE, ZONE_FINISH);
+		zone->cond = BLK_ZONE_COND_FULL;
+	}
+
+	if (zone->cond == BLK_ZONE_COND_FULL ||
+	    zone->wp + size > zone->start + zone->capacity) {
+		zone_command(zone, BLKRESETZONE, ZONE_RESET);
+		zone->cond = BLK_ZONE_COND_EMPTY;
+		zone->wp = zone->start;
+	}
+
+	if (zone_open && zone->cond == BLK_ZONE_COND_EMPTY) {
+		zone_command(zone, BLKOPENZONE, ZONE_OPEN);
+		zone->cond = BLK_ZONE_COND_EXP_OPEN;
+	}
+
+	switch (zone->cond) {
+	case BLK_ZONE_COND_EMPTY:
+		zone_cond = ZONE_EMPTY;
+		break;
+	case BLK_ZONE_COND_IMP_OPEN:
+		zone_cond = ZONE_IMP_OPEN;
+		break;
+	case BLK_ZONE_COND_EXP_OPEN:
+		zone_cond = ZONE_EXP_OPEN;
+		break;
+	case BLK_ZONE_COND_CLOSED:
+		zone_cond = ZONE_CLOSED;
+		break;
+	default:
+		zone_cond = -1;
+	}
+
+	return zone->wp;
+}
+
+#else /* HAVE_ZONED */
+
+static void zone_setup(void)
+{
+}
+
+static off_t zone_next(void)
+{
+	return 0;
+}
+
+#endif /* HAVE_ZONED */
+
+/*
+ * Copy requests: range of working file is copied to the same offset of
+ * destination file "ioping.dst" with copy_file_range(), cloned with
+ * FICLONERANGE or deduplicated with FIDEDUPERANGE. Destination is prepared
+ * as exact copy, thus deduplication finds equal data. In the end FIEMAP of
+ * destination shows how much of it shares extents and how much is copied.
+ */
+static int copy_fd = -1;
+static long long copy_shared = -1, copy_exclusive = -1;
+
+#ifdef HAVE_COPY
+
+static ssize_t copy_request(int fd, void *buf, size_t nbytes, off_t off)
+{
+	union {
+		struct file_dedupe_range range;
+		char buf[sizeof(struct file_dedupe_range) +
+			 sizeof(struct file_dedupe_range_info)];
+	} dedupe;
+	struct file_clone_range clone;
+	loff_t src = off, dst = off;
+	ssize_t ret = -1;
+
+	(void)buf;
+	switch (copy_mode) {
+	case COPY_RANGE:
+		ret = syscall(__NR_copy_file_range, fd, &src, copy_fd, &dst,
+			      nbytes, 0);
+		break;
+	case COPY_CLONE:
+		clone.src_fd = fd;
+		clone.src_offset = off;
+		clone.src_length = nbytes;
+		clone.dest_offset = off;
+		if (!ioctl(copy_fd, FICLONERANGE, &clone))
+			ret = nbytes;
+		break;
+	case COPY_DEDUPE:
+		memset(&dedupe, 0, sizeof(dedupe));
+		dedupe.range.src_offset = off;
+		dedupe.range.src_length = nbytes;
+		dedupe.range.dest_count = 1;
+		dedupe.range.info[0].dest_fd = copy_fd;
+		dedupe.range.info[0].dest_offset = off;
+		if (ioctl(fd, FIDEDUPERANGE, &dedupe.range))
+			break;
+		if (dedupe.range.info[0].status < 0)
+			errno = -dedupe.range.info[0].status;
+		else if (dedupe.range.info[0].status)
+			errno = EILSEQ;	/* contents differ */
+		else
+			ret = dedupe.range.info[0].bytes_deduped;
+		break;
+	}
+
+	if (ret > 0 && !cached)
+		sync_file(copy_fd);
+	return ret;
+}
+
+static void copy_setup(const char *path, void *buf)
+{
+	off_t pos;
+	ssize_t len;
+
+	copy_fd = open_file(path, "ioping.dst");
+	if (copy_fd < 0)
+		err(2, "failed to create destination file at \"%s\"", path);
+	if (ftruncate(copy_fd, 0))
+		err(2, "ftruncate failed");
+
+	for (pos = offset; pos < offset + wsize; pos += len) {
+		len = offset + wsize - pos < size ? offset + wsize - pos : size;
+		len = pread(target_fd, buf, len, pos);
+		if (len <= 0 || pwrite(copy_fd, buf, len, pos) != len)
+			err(2, "preparation copy failed");
+	}
+	if (fsync(copy_fd))
+		err(2, "fsync failed");
+
+	make_request = copy_request;
+}
+
+#define COPY_EXTENTS	256
+
+/* sum extents of destination working set by FIEMAP_EXTENT_SHARED */
+static void copy_extents(void)
+{
+	struct fiemap *map;
+	struct fiemap_extent *e;
+	off_t pos = offset, end = offset + wsize;
+	long long lo, hi;
+	unsigned i;
+
+	map = malloc(sizeof(*map) + COPY_EXTENTS * sizeof(map->fm_extents[0]));
+	if (!map)
+		err(3, NULL);
+
+	copy_shared = copy_exclusive = 0;
+	while (pos < end) {
+		memset(map, 0, sizeof(*map));
+		map->fm_start = pos;
+		map->fm_length = end - pos;
+		map->fm_flags = FIEMAP_FLAG_SYNC;
+		map->fm_extent_count = COPY_EXTENTS;
+		if (ioctl(copy_fd, FS_IOC_FIEMAP, map)) {
+			copy_shared = copy_exclusive = -1;
+			break;
+		}
+		if (!map->fm_mapped_extents)
+			break;
+		for (i = 0; i < map->fm_mapped_extents; i++) {
+			e = &map->fm_extents[i];
+			lo = e->fe_logical > (unsigned long long)pos ?
+				(long long)e->fe_logical : pos;
+			hi = e->fe_logical + e->fe_length;
+			if (hi > end)
+				hi = end;
+			if (hi > lo) {
+				if (e->fe_flags & FIEMAP_EXTENT_SHARED)
+					copy_shared += hi - lo;
+				else
+					copy_exclusive += hi - lo;
+			}
+			pos = e->fe_logical + e->fe_length;
+		}
+		if (e->fe_flags & FIEMAP_EXTENT_LAST)
+			break;
+	}
+	free(map);
+}
+
+#else /* HAVE_COPY */
+
+static void copy_setup(const char *path, void *buf)
+{
+	(void)path;
+	(void)buf;
+}
+
+static void copy_extents(void)
+{
+}
+
+#endif /* HAVE_COPY */
+
+/*
+ * Engine pairs for -zerocopy and -sgio: each offset is requested twice in
+ * a row by regular and alternative engine, order alternates, thus both see
+ * the same offsets and cache state. Summary compares them.
+ */
+enum {
+	PAIR_BASE,
+	PAIR_ENGINE,
+};
+
+static struct statistics pair_stats[2];
+static int pair_engine;
+static ssize_t (*pair_request)(int fd, void *buf, size_t nbytes, off_t offset);
+static const char *pair_key, *pair_base, *pair_name;
+
+/*
+ * Zero-copy reads: splice() moves range from target into pipe, sendfile()
+ * into unix socket, both drained by splice into /dev/null, in chunks of
+ * pipe capacity. Paired with pread, cpu time per byte is compared too.
+ */
+
+#ifdef HAVE_ZEROCOPY
+
+static int zerocopy_pipe[2] = { -1, -1 };
+static int zerocopy_sock[2] = { -1, -1 };
+static int zerocopy_null = -1;
+static size_t zerocopy_chunk;
+
+static int zerocopy_drain(int fd, size_t len)
+{
+	ssize_t ret;
+
+	while (len) {
+		if (fd != zerocopy_pipe[0]) {
+			ret = splice(fd, NULL, zerocopy_pipe[1], NULL, len,
+				     SPLICE_F_MOVE);
+			if (ret <= 0)
+				return -1;
+		} else
+			ret = len;
+		ret = splice(zerocopy_pipe[0], NULL, zerocopy_null, NULL, ret,
+			     SPLICE_F_MOVE);
+		if (ret <= 0)
+			return -1;
+		len -= ret;
+	}
+	return 0;
+}
+
+static ssize_t zerocopy_read(int fd, void *buf, size_t nbytes, off_t off)
+{
+	loff_t pos = off;
+	size_t done = 0;
+	ssize_t ret;
+	int sink;
+
+	(void)buf;
+	while (done < nbytes) {
+		ret = nbytes - done;
+		if ((size_t)ret > zerocopy_chunk)
+			ret = zerocopy_chunk;
+		if (zerocopy == ZEROCOPY_SPLICE) {
+			sink = zerocopy_pipe[0];
+			ret = splice(fd, &pos, zerocopy_pipe[1], NULL, ret,
+				     SPLICE_F_MOVE);
+		} else {
+			sink = zerocopy_sock[1];
+			ret = sendfile(zerocopy_sock[0], fd, &pos, ret);
+		}
+		if (ret < 0)
+			return done ? (ssize_t)done : -1;
+		if (!ret)
+			break;
+		if (zerocopy_drain(sink, ret))
+			err(3, "zero-copy drain failed");
+		done += ret;
+	}
+	return done;
+}
+
+static void zerocopy_setup(void)
+{
+	int ret;
+
+	if (pipe(zerocopy_pipe))
+		err(2, "pipe failed");
+	zerocopy_null = open("/dev/null", O_WRONLY);
+	if (zerocopy_null < 0)
+		err(2, "failed to open /dev/null");
+
+	/* pipe-max-size limits unprivileged users */
+	(void)fcntl(zerocopy_pipe[1], F_SETPIPE_SZ, size);
+	ret = fcntl(zerocopy_pipe[1], F_GETPIPE_SZ);
+	if (ret <= 0)
+		err(2, "fcntl(F_GETPIPE_SZ) failed");
+	zerocopy_chunk = ret;
+
+	if (zerocopy == ZEROCOPY_SENDFILE) {
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, zerocopy_sock))
+			err(2, "socketpair failed");
+		(void)setsockopt(zerocopy_sock[0], SOL_SOCKET, SO_SNDBUF,
+				 &ret, sizeof(ret));
+	}
+
+	pair_request = zerocopy_read;
+	pair_key = "zerocopy";
+	pair_base = "pread";
+	pair_name = zerocopy_name;
+}
+
+#else /* HAVE_ZEROCOPY */
+
+static ssize_t zerocopy_read(int fd, void *buf, size_t nbytes, off_t off)
+{
+	return pread(fd, buf, nbytes, off);
+}
+
+static void zerocopy_setup(void)
+{
+}
+
+#endif /* HAVE_ZEROCOPY */
+
+/*
+ * SCSI passthrough: READ(16) and WRITE(16) commands are sent by SG_IO ioctl
+ * to /dev/sgN or block device, bypassing filesystem, page cache and block
+ * layer queueing. Command duration measured by kernel is collected apart,
+ * with millisecond resolution. Block device requests are paired with -D
+ * reads or writes through block layer. Writes set FUA unless -C.
+ */
+#define SGIO_TIMEOUT	60000	/* ms */
+
+static struct statistics sgio_stats;
+static long long sgio_duration = -1;
+static unsigned sgio_block;
+
+#ifdef HAVE_SGIO
+
+static void put_be(unsigned char *p, unsigned long long val, int len)
+{
+	while (len--) {
+		p[len] = val;
+		val >>= 8;
+	}
+}
+
+static unsigned long long get_be(const unsigned char *p, int len)
+{
+	unsigned long long val = 0;
+
+	while (len--)
+		val = (val << 8) | *p++;
+	return val;
+}
+
+static ssize_t sgio_command(int fd, unsigned char *cdb, int dir,
+			    void *buf, size_t len)
+{
+	unsigned char sense[32];
+	struct sg_io_hdr hdr;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.interface_id = 'S';
+	hdr.cmd_len = 16;
+	hdr.cmdp = cdb;
+	hdr.dxfer_direction = dir;
+	hdr.dxferp = buf;
+	hdr.dxfer_len = len;
+	hdr.sbp = sense;
+	hdr.mx_sb_len = sizeof(sense);
+	hdr.timeout = SGIO_TIMEOUT;
+	if (ioctl(fd, SG_IO, &hdr))
+		return -1;
+	if ((hdr.info & SG_INFO_OK_MASK) != SG_INFO_OK) {
+		errno = EIO;
+		return -1;
+	}
+	sgio_duration = hdr.duration * 1000000ll;
+	return len - hdr.resid;
+}
+
+static ssize_t sgio_request(int fd, void *buf, size_t nbytes, off_t off)
+{
+	unsigned char cdb[16];
+
+	memset(cdb, 0, sizeof(cdb));
+	cdb[0] = write_test ? 0x8a : 0x88;	/* WRITE(16) : READ(16) */
+	if (write_test && !cached)
+		cdb[1] = 0x08;			/* FUA */
+	put_be(cdb + 2, off / sgio_block, 8);
+	put_be(cdb + 10, nbytes / sgio_block, 4);
+	return sgio_command(fd, cdb, write_test ? SG_DXFER_TO_DEV :
+			    SG_DXFER_FROM_DEV, buf, nbytes);
+}
+
+static void sgio_setup(struct stat *st)
+{
+	unsigned char cdb[16], cap[32];
+
+	/* SERVICE ACTION IN(16), READ CAPACITY(16) */
+	memset(cdb, 0, sizeof(cdb));
+	cdb[0] = 0x9e;
+	cdb[1] = 0x10;
+	cdb[13] = sizeof(cap);
+	if (sgio_command(target_fd, cdb, SG_DXFER_FROM_DEV,
+			 cap, sizeof(cap)) < 0)
+		err(2, "READ CAPACITY(16) failed for \"%s\"", path);
+	sgio_duration = -1;
+
+	sgio_block = get_be(cap + 8, 4);
+	if (!sgio_block)
+		errx(2, "invalid logical block size");
+	if (size % sgio_block || offset % sgio_block)
+		errx(2, "request size and offset must be multiple of %u",
+		     sgio_block);
+	st->st_size = (get_be(cap, 8) + 1) * sgio_block;
+	device_size = st->st_size;
+
+	if (S_ISBLK(st->st_mode)) {
+		pair_request = sgio_request;
+		pair_key = "sgio";
+		pair_base = "block";
+		pair_name = "sg_io";
+	} else
+		make_request = sgio_request;
+}
+
+#else /* HAVE_SGIO */
+
+static void sgio_setup(struct stat *st)
+{
+	(void)st;
+}
+
+#endif /* HAVE_SGIO */
+
+/*
+ * RWF flag matrix: each offset is requested once with every flag set, order
+ * of sets rotates from offset to offset. Before start each set is probed by
+ * one request at working set start, thus flags refused by kernel or
+ * filesystem (EOPNOTSUPP, EINVAL) fail preparation instead of every request.
+ */
+static struct statistics rwf_stats[MAX_RWF_SETS];
+
+static void rwf_probe(void)
+{
+	int saved = rw_flags;
+	int i;
+
+	for (i = 0; i < (nr_rwf_sets ? nr_rwf_sets : 1); i++) {
+		if (nr_rwf_sets)
+			rw_flags = rwf_sets[i] & ~RWF_FDATASYNC;
+		if (make_request(target_fd, buf, size, offset) < 0 &&
+		    errno != EAGAIN)
+			err(2, "request with RWF flags \"%s\" failed",
+			    rwf_string(rw_flags));
+	}
+	rw_flags = saved;
+}
+
+static void rwf_summary(void)
+{
+	int i, width = 0;
+
+	for (i = 0; i < nr_rwf_sets; i++)
+		if ((int)strlen(rwf_string(rwf_sets[i])) > width)
+			width = strlen(rwf_string(rwf_sets[i]));
+
+	for (i = 0; i < nr_rwf_sets; i++) {
+		struct statistics *r = &rwf_stats[i];
+
+		printf("rwf %-*s ", width, rwf_string(rwf_sets[i]));
+		print_int(r->valid);
+		printf(" requests, ");
+		print_int(r->iops);
+		printf(" iops, min/avg/max/mdev = ");
+		print_time(r->min);
+		printf(" / ");
+		print_time(r->avg);
+		printf(" / ");
+		print_time(r->max);
+		printf(" / ");
+		print_time(r->mdev);
+		if (i && rwf_stats[0].avg > 0)
+			printf(", avg x%.2f", r->avg / rwf_stats[0].avg);
+		printf("\n");
+	}
+}
+
+/*
+ * Latency breakdown: block layer tracepoints block_rq_insert, block_rq_issue
+ * and block_rq_complete are sampled by perf for all cpus into ring buffers
+ * with CLOCK_MONOTONIC timestamps and matched to request by device and
+ * sectors. Time before insert and after completion is spent in filesystem
+ * and page cache, between insert and issue in block layer queue, between
+ * issue and completion in device.
+ */
+
+enum {
+	BREAKDOWN_FS,
+	BREAKDOWN_QUEUE,
+	BREAKDOWN_DEVICE,
+	BREAKDOWN_PARTS,
+};
+
+static const char *breakdown_names[BREAKDOWN_PARTS] = {
+	"fs",
+	"queue",
+	"device",
+};
+
+struct breakdown {
+	int		matched;	/* block requests found */
+	long long	time[BREAKDOWN_PARTS];
+};
+
+static struct statistics breakdown_part[BREAKDOWN_PARTS];
+static struct statistics breakdown_total[BREAKDOWN_PARTS];
+static long long breakdown_lost;	/* block events dropped by perf */
+
+static void add_breakdown(struct breakdown *b)
+{
+	int i;
+
+	for (i = 0; i < BREAKDOWN_PARTS; i++) {
+		if (i != BREAKDOWN_FS && !b->matched)
+			continue;
+		breakdown_part[i].count++;
+		add_valid(&breakdown_part[i], b->time[i]);
+	}
+}
+
+#ifdef HAVE_PERF_EVENTS
+
+enum {
+	BLOCK_INSERT,
+	BLOCK_ISSUE,
+	BLOCK_COMPLETE,
+	BLOCK_EVENTS,
+};
+
+static const char *block_events[BLOCK_EVENTS] = {
+	"block_rq_insert",
+	"block_rq_issue",
+	"block_rq_complete",
+};
+
+static struct {
+	int id, dev, sector, nr_sector;
+} block_format[BLOCK_EVENTS];
+
+#define BLOCK_BUFFER_PAGES	16
+
+static struct perf_event_mmap_page **block_buffers;
+static int block_nr_buffers;
+static size_t block_page_size;
+
+static unsigned block_dev;		/* kernel dev_t, 0 - any */
+static long long block_start;		/* partition start in sectors */
+static int block_file;			/* map offsets by FIEMAP */
+
+/* current request */
+static long long block_lo, block_hi;	/* sectors, -1 - unknown */
+static long long block_since;
+static long long block_time[BLOCK_EVENTS];
+
+static void block_parse_format(int event)
+{
+	static const char *tracefs[] = {
+		"/sys/kernel/tracing",
+		"/sys/kernel/debug/tracing",
+	};
+	char name[PATH_MAX], line[256], *field, *end, *ptr;
+	FILE *file = NULL;
+	unsigned i;
+
+	for (i = 0; !file && i < sizeof(tracefs) / sizeof(tracefs[0]); i++) {
+		snprintf(name, sizeof(name), "%s/events/block/%s/format",
+			 tracefs[i], block_events[event]);
+		file = fopen(name, "r");
+	}
+	if (!file)
+		err(2, "failed to open format of tracepoint %s, "
+		       "tracefs is not mounted or not permitted",
+		       block_events[event]);
+
+	block_format[event].dev = -1;
+	block_format[event].sector = -1;
+	block_format[event].nr_sector = -1;
+
+	while (fgets(line, sizeof(line), file)) {
+		if (sscanf(line, "ID: %d", &block_format[event].id) == 1)
+			continue;
+		field = strstr(line, "field:");
+		ptr = strstr(line, "offset:");
+		if (!field || !ptr)
+			continue;
+		end = strchr(field, ';');
+		if (!end)
+			continue;
+		*end = 0;
+		field = strrchr(field, ' ');
+		if (!field)
+			continue;
+		field++;
+		if (!strcmp(field, "dev"))
+			block_format[event].dev = atoi(ptr + 7);
+		else if (!strcmp(field, "sector"))
+			block_format[event].sector = atoi(ptr + 7);
+		else if (!strcmp(field, "nr_sector"))
+			block_format[event].nr_sector = atoi(ptr + 7);
+	}
+	fclose(file);
+
+	if (!block_format[event].id || block_format[event].dev < 0 ||
+	    block_format[event].sector < 0 ||
+	    block_format[event].nr_sector < 0)
+		errx(2, "unsupported format of tracepoint %s",
+		     block_events[event]);
+}
+
+/* find whole disk and partition start for device */
+static void block_parse_device(dev_t dev, int file)
+{
+	unsigned major = major(dev), minor = minor(dev);
+	char buf[64];
+
+	block_file = file;
+
+	if (read_sysfs("/sys/dev/block/%u:%u/dev", major, minor,
+		       buf, sizeof(buf))) {
+		warnx("%u:%u is not a block device, "
+		      "breakdown matches requests only by time", major, minor);
+		block_file = 0;
+		return;
+	}
+
+	if (!read_sysfs("/sys/dev/block/%u:%u/partition", major, minor,
+			buf, sizeof(buf))) {
+		if (read_sysfs("/sys/dev/block/%u:%u/start", major, minor,
+			       buf, sizeof(buf)))
+			err(2, "failed to read partition start");
+		block_start = atoll(buf);
+		if (read_sysfs("/sys/dev/block/%u:%u/../dev", major, minor,
+			       buf, sizeof(buf)) ||
+		    sscanf(buf, "%u:%u", &major, &minor) != 2)
+			err(2, "failed to find whole disk of partition");
+	}
+
+	/* MKDEV() in kernel */
+	block_dev = major << 20 | minor;
+}
+
+static void breakdown_setup(dev_t dev, int file)
+{
+	struct perf_event_attr attr;
+	int nr_cpus, cpu, event, fd, leader;
+	void *buf;
+
+	for (event = 0; event < BLOCK_EVENTS; event++)
+		block_parse_format(event);
+
+	block_parse_device(dev, file);
+
+	block_page_size = sysconf(_SC_PAGESIZE);
+	nr_cpus = sysconf(_SC_NPROCESSORS_CONF);
+	block_buffers = calloc(nr_cpus, sizeof(*block_buffers));
+	if (!block_buffers)
+		err(2, NULL);
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_TRACEPOINT;
+	attr.sample_period = 1;
+	attr.sample_type = PERF_SAMPLE_TIME | PERF_SAMPLE_RAW;
+	attr.use_clockid = 1;
+	attr.clockid = CLOCK_MONOTONIC;
+
+	for (cpu = 0; cpu < nr_cpus; cpu++) {
+		leader = -1;
+		for (event = 0; event < BLOCK_EVENTS; event++) {
+			attr.config = block_format[event].id;
+			fd = perf_event_open(&attr, -1, cpu, -1, 0);
+			if (fd < 0 && errno == ENODEV)
+				break;	/* offline cpu */
+			if (fd < 0)
+				err(2, "perf_event_open for %s failed, "
+				       "breakdown requires privileges",
+				       block_events[event]);
+			if (leader >= 0) {
+				if (ioctl(fd, PERF_EVENT_IOC_SET_OUTPUT, leader))
+					err(2, "perf output redirect failed");
+				continue;
+			}
+			leader = fd;
+			buf = mmap(NULL, (BLOCK_BUFFER_PAGES + 1) *
+				   block_page_size, PROT_READ | PROT_WRITE,
+				   MAP_SHARED, fd, 0);
+			if (buf == MAP_FAILED)
+				err(2, "perf buffer mmap failed");
+			block_buffers[block_nr_buffers++] = buf;
+		}
+	}
+
+	if (!block_nr_buffers)
+		errx(2, "no cpus for tracing");
+}
+
+static void block_sample(long long time, unsigned char *raw)
+{
+	unsigned short type;
+	unsigned dev, nr_sector;
+	unsigned long long sector;
+	int event;
+
+	memcpy(&type, raw, sizeof(type));
+	for (event = 0; event < BLOCK_EVENTS; event++)
+		if (block_format[event].id == type)
+			break;
+	if (event == BLOCK_EVENTS || time < block_since)
+		return;
+
+	memcpy(&dev, raw + block_format[event].dev, sizeof(dev));
+	memcpy(&sector, raw + block_format[event].sector, sizeof(sector));
+	memcpy(&nr_sector, raw + block_format[event].nr_sector,
+	       sizeof(nr_sector));
+
+	if (block_dev && dev != block_dev)
+		return;
+	if (block_lo >= 0 && ((long long)sector >= block_hi ||
+			      (long long)(sector + nr_sector) <= block_lo))
+		return;
+
+	/* request might be split: first insert and issue, last completion */
+	if (event == BLOCK_COMPLETE) {
+		if (time > block_time[event])
+			block_time[event] = time;
+	} else if (!block_time[event] || time < block_time[event]) {
+		block_time[event] = time;
+	}
+}
+
+static void block_drain(void)
+{
+	unsigned char record[1024];
+	size_t data_size = BLOCK_BUFFER_PAGES * block_page_size;
+	int i;
+
+	for (i = 0; i < block_nr_buffers; i++) {
+		struct perf_event_mmap_page *pc = block_buffers[i];
+		unsigned char *data = (unsigned char *)pc + block_page_size;
+		unsigned long long head, tail = pc->data_tail;
+
+		head = __atomic_load_n(&pc->data_head, __ATOMIC_ACQUIRE);
+		while (tail < head) {
+			struct perf_event_header hdr;
+			size_t pos = tail % data_size, len, part;
+
+			memcpy(&hdr, data + pos, sizeof(hdr));
+			len = hdr.size;
+			if (len < sizeof(hdr)) {
+				/* broken ring, rest is dropped */
+				breakdown_lost++;
+				break;
+			}
+			tail += len;
+			if (len > sizeof(record)) {
+				breakdown_lost++;
+				continue;
+			}
+			part = data_size - pos < len ? data_size - pos : len;
+			memcpy(record, data + pos, part);
+			memcpy(record + part, data, len - part);
+
+			/* header, u64 time, u32 raw size, raw data */
+			if (hdr.type == PERF_RECORD_SAMPLE) {
+				long long time;
+
+				memcpy(&time, record + sizeof(hdr), sizeof(time));
+				block_sample(time, record + sizeof(hdr) +
+					     sizeof(time) + sizeof(unsigned));
+			} else if (hdr.type == PERF_RECORD_LOST) {
+				/* header, u64 id, u64 lost */
+				unsigned long long lost;
+
+				memcpy(&lost, record + sizeof(hdr) +
+				       sizeof(lost), sizeof(lost));
+				breakdown_lost += lost;
+			}
+		}
+		__atomic_store_n(&pc->data_tail, head, __ATOMIC_RELEASE);
+	}
+}
+
+static void breakdown_start(int fd, off_t pos, size_t len)
+{
+	union {
+		struct fiemap map;
+		char buf[sizeof(struct fiemap) + sizeof(struct fiemap_extent)];
+	} fm;
+	struct fiemap_extent *extent = fm.map.fm_extents;
+
+	/* drop events before this request */
+	block_since = LLONG_MAX;
+	block_drain();
+	memset(block_time, 0, sizeof(block_time));
+
+	block_lo = block_hi = -1;
+	if (!block_file) {
+		if (block_dev) {
+			block_lo = block_start + pos / 512;
+			block_hi = block_start + (pos + len + 511) / 512;
+		}
+		return;
+	}
+
+	memset(&fm, 0, sizeof(fm));
+	fm.map.fm_start = pos;
+	fm.map.fm_length = len;
+	fm.map.fm_extent_count = 1;
+	if (ioctl(fd, FS_IOC_FIEMAP, &fm) || fm.map.fm_mapped_extents != 1 ||
+	    (extent->fe_flags & (FIEMAP_EXTENT_UNKNOWN |
+				 FIEMAP_EXTENT_DELALLOC |
+				 FIEMAP_EXTENT_ENCODED)))
+		return;
+
+	pos = extent->fe_physical + (pos - extent->fe_logical);
+	block_lo = block_start + pos / 512;
+	block_hi = block_start + (pos + len + 511) / 512;
+}
+
+static void breakdown_finish(long long start, long long io_time,
+			     struct breakdown *b)
+{
+	long long insert, issue, complete;
+
+	block_since = start;
+	block_drain();
+
+	insert = block_time[BLOCK_INSERT];
+	issue = block_time[BLOCK_ISSUE];
+	complete = block_time[BLOCK_COMPLETE];
+
+	memset(b, 0, sizeof(*b));
+	b->time[BREAKDOWN_FS] = io_time;
+	if (!issue || complete < issue)
+		return;
+
+	/* direct issue bypasses insert */
+	if (!insert || insert > issue)
+		insert = issue;
+
+	b->matched = 1;
+	b->time[BREAKDOWN_QUEUE] = issue - insert;
+	b->time[BREAKDOWN_DEVICE] = complete - issue;
+	b->time[BREAKDOWN_FS] = io_time - (complete - insert);
+	if (b->time[BREAKDOWN_FS] < 0)
+		b->time[BREAKDOWN_FS] = 0;
+}
+
+#else /* HAVE_PERF_EVENTS */
+
+static void breakdown_setup(dev_t dev, int file)
+{
+	(void)dev;
+	(void)file;
+	errx(1, "latency breakdown not supported by this platform");
+}
+
+static void breakdown_start(int fd, off_t pos, size_t len)
+{
+	(void)fd;
+	(void)pos;
+	(void)len;
+}
+
+static void breakdown_finish(long long start, long long io_time,
+			     struct breakdown *b)
+{
+	(void)start;
+	memset(b, 0, sizeof(*b));
+	b->time[BREAKDOWN_FS] = io_time;
+}
+
+#endif /* HAVE_PERF_EVENTS */
+
+/* interpolated value at given 1-based rank */
+static double hist_rank(struct statistics *s, double rank)
+{
+	unsigned long long sum = 0;
+	double val;
+	int i;
+
+	if (rank < 1)
+		rank = 1;
+	if (rank > s->valid)
+		rank = s->valid;
+	for (i = 0; i < HIST_SIZE; i++) {
+		if (!s->hist[i])
+			continue;
+		if (sum + s->hist[i] >= rank)
+			break;
+		sum += s->hist[i];
+	}
+	if (i == HIST_SIZE)
+		return s->max;
+	val = hist_lower(i) + (double)(hist_upper(i) - hist_lower(i)) *
+		(rank - sum) / s->hist[i];
+	if (val < s->min)
+		return s->min;
+	if (val > s->max)
+		return s->max;
+	return val;
+}
+
+#define PERCENTILE_Z	1.96	/* 95% confidence */
+
+struct percentile {
+	double value, lower, upper;
+};
+
+/* distribution-free confidence interval from binomial order statistics */
+static void get_percentile(struct statistics *s, double p,
+			   struct percentile *r)
+{
+	double n = s->valid, q = p / 100;
+	double d = PERCENTILE_Z * sqrt(n * q * (1 - q));
+
+	r->value = hist_rank(s, ceil(n * q));
+	r->lower = hist_rank(s, floor(n * q - d));
+	r->upper = hist_rank(s, ceil(n * q + d) + 1);
+}
+
+#define CONVERGE_TAIL	10	/* minimum requests beyond percentile */
+#define CONVERGE_CHECK	(NSEC_PER_SEC / 10)
+
+static int check_converge(struct statistics *s)
+{
+	struct percentile r;
+	int i;
+
+	for (i = 0; i < nr_percentiles; i++) {
+		double q = percentiles[i] / 100;
+
+		if (s->valid * q < CONVERGE_TAIL ||
+		    s->valid * (1 - q) < CONVERGE_TAIL)
+			return 0;
+		get_percentile(s, percentiles[i], &r);
+		if (r.upper - r.lower > 2 * converge * r.value)
+			return 0;
+	}
+	return 1;
+}
+
+static void print_percentiles(struct statistics *s)
+{
+	struct percentile r;
+	int i;
+
+	for (i = 0; i < nr_percentiles; i++) {
+		get_percentile(s, percentiles[i], &r);
+		printf("%sp%g = ", i ? ", " : "", percentiles[i]);
+		print_time(r.value);
+		printf(" (");
+		print_time(r.lower);
+		printf(" .. ");
+		print_time(r.upper);
+		printf(")");
+	}
+}
+
+/* "<name> <count> requests, min/avg/max/mdev = ...", without newline */
+static void print_summary_line(const char *name, struct statistics *s)
+{
+	printf("%s ", name);
+	print_int(s->valid);
+	printf(" requests, min/avg/max/mdev = ");
+	print_time(s->min);
+	printf(" / ");
+	print_time(s->avg);
+	printf(" / ");
+	print_time(s->max);
+	printf(" / ");
+	print_time(s->mdev);
+	if (nr_percentiles) {
+		printf(", ");
+		print_percentiles(s);
+	}
+}
+
+static double slo_value(struct statistics *s, struct slo *o)
+{
+	struct percentile r;
+
+	switch (o->metric) {
+	case SLO_IOPS:
+		return s->iops;
+	case SLO_BPS:
+		return s->speed;
+	case SLO_ERRORS:
+		return s->count ? (double)s->failed / s->count : 0;
+	}
+
+	/* latency objectives fail without valid requests */
+	if (!s->valid)
+		return NAN;
+
+	switch (o->metric) {
+	case SLO_PERCENTILE:
+		get_percentile(s, o->percentile, &r);
+		return r.value;
+	case SLO_MIN:
+		return s->min;
+	case SLO_AVG:
+		return s->avg;
+	case SLO_MAX:
+		return s->max;
+	case SLO_MDEV:
+		return s->mdev;
+	}
+	return NAN;
+}
+
+static int slo_pass(struct statistics *s, struct slo *o)
+{
+	double val = slo_value(s, o);
+
+	if (o->below)
+		return o->equal ? val <= o->limit : val < o->limit;
+	return o->equal ? val >= o->limit : val > o->limit;
+}
+
+/* returns count of violated objectives */
+static int check_slo(struct statistics *s)
+{
+	int i, failed = 0;
+
+	for (i = 0; i < nr_slo; i++)
+		failed += !slo_pass(s, &slo[i]);
+	return failed;
+}
 
-	if (s->valid) {
-		s->avg = s->sum / s->valid;
-		s->mdev = sqrt(s->sum2 / s->valid - s->avg * s->avg);
-	} else {
-		s->min = 0;
-		s->max = 0;
+static void print_slo(struct statistics *s)
+{
+	int i, first = 1;
+
+	if (!check_slo(s)) {
+		printf("slo passed\n");
+		return;
 	}
 
-	if (s->sum)
-		s->iops = (double)NSEC_PER_SEC * s->valid / s->sum;
+	printf("slo violated:");
+	for (i = 0; i < nr_slo; i++) {
+		if (slo_pass(s, &slo[i]))
+			continue;
+		printf("%s %s (", first ? "" : ",", slo[i].text);
+		switch (slo[i].metric) {
+		case SLO_IOPS:
+			print_int(slo_value(s, &slo[i]));
+			printf(" iops");
+			break;
+		case SLO_BPS:
+			print_size(slo_value(s, &slo[i]));
+			printf("/s");
+			break;
+		case SLO_ERRORS:
+			printf("%g%%", slo_value(s, &slo[i]) * 100);
+			break;
+		default:
+			if (s->valid)
+				print_time(slo_value(s, &slo[i]));
+			else
+				printf("no valid requests");
+		}
+		printf(")");
+		first = 0;
+	}
+	printf("\n");
+}
 
-	if (s->load_time)
-		s->load_iops = (double)NSEC_PER_SEC * s->count / s->load_time;
+static void warn_slo(struct statistics *s)
+{
+	int i;
 
-	s->speed = s->iops * size;
-	s->load_speed = s->load_iops * size;
-	s->size = s->valid * size;
-	s->load_size = s->count * size;
+	for (i = 0; i < nr_slo; i++)
+		if (!slo_pass(s, &slo[i]))
+			warnx("slo violated: %s", slo[i].text);
 }
 
 static void dump_statistics(struct statistics *s) {
-	printf("%llu %.0f %.0f %.0f %llu %.0f %llu %.0f %llu %llu\n",
+	printf("%llu %.0f %.0f %.0f %llu %.0f %llu %.0f %llu %llu",
 	       s->valid, s->sum, s->iops, s->speed,
 	       s->min, s->avg, s->max, s->mdev,
 	       s->count, s->load_time);
+	if (cpu_stats)
+		printf(" %llu %llu %llu %llu", s->cpu.time, s->cpu.vcsw,
+		       s->cpu.ivcsw, s->cpu.migrations);
+	if (perf_stats) {
+		int i;
+
+		for (i = 0; i < PERF_EVENTS; i++)
+			printf(" %lld", perf_available[i] ?
+					s->perf.count[i] : -1ll);
+	}
+	if (pressure) {
+		int i;
+
+		for (i = 0; i < STALL_COUNTERS; i++)
+			printf(" %lld", stall_available[i] ?
+					s->pressure.stall[i] : -1ll);
+		printf(" %lld %lld", s->pressure.dirty, s->pressure.writeback);
+		for (i = 0; i < VMSTAT_COUNTERS; i++)
+			printf(" %lld", s->pressure.vmstat[i]);
+	}
+	if (cgroup_settings) {
+		int i;
+
+		for (i = 0; i < CGROUP_COUNTERS; i++)
+			printf(" %lld", cgroup_available[i] ?
+					s->cgroup.stat[i] : -1ll);
+		if (nr_cgroup_weights)
+			printf(" %u", cgroup_weights[cgroup_weight]);
+	}
+	printf("\n");
+}
+
+static void json_pressure(struct pressure *p, const char *indent)
+{
+	int i;
+
+	printf(",\n%s\"pressure\": {", indent);
+	for (i = 0; i < STALL_COUNTERS; i++) {
+		printf("\n%s  \"%s\": ", indent, stall_names[i]);
+		if (stall_available[i])
+			printf("%lld,", p->stall[i]);
+		else
+			printf("null,");
+	}
+	printf("\n%s  \"dirty\": %lld,"
+	       "\n%s  \"writeback\": %lld",
+	       indent, p->dirty, indent, p->writeback);
+	for (i = 0; i < VMSTAT_COUNTERS; i++)
+		printf(",\n%s  \"%s\": %lld", indent, vmstat_names[i],
+		       p->vmstat[i]);
+	printf("\n%s}", indent);
+}
+
+static void json_perf_usage(struct perf_usage *u, const char *indent)
+{
+	int i;
+
+	printf(",\n%s\"perf\": {", indent);
+	for (i = 0; i < PERF_EVENTS; i++) {
+		printf("%s\n%s  \"%s\": ", i ? "," : "", indent,
+		       perf_names[i]);
+		if (perf_available[i])
+			printf("%lld", u->count[i]);
+		else
+			printf("null");
+	}
+	printf("\n%s}", indent);
+}
+
+static void json_cpu_usage(struct cpu_usage *u, const char *indent)
+{
+	printf(",\n%s\"cpu\": {\n"
+	       "%s  \"time\": %llu,\n"
+	       "%s  \"voluntary_switches\": %llu,\n"
+	       "%s  \"involuntary_switches\": %llu,\n"
+	       "%s  \"migrations\": %llu\n"
+	       "%s}",
+	       indent, indent, u->time, indent, u->vcsw,
+	       indent, u->ivcsw, indent, u->migrations, indent);
 }
 
-static void json_request(long long io_size, long long io_time, int valid)
+static void json_request(long long io_size, long long io_time, int valid,
+			 struct cpu_usage *cpu, struct perf_usage *perf,
+			 struct breakdown *bd)
 {
 	update_timestamp();
 
@@ -1526,9 +5383,7 @@ static void json_request(long long io_size, long long io_time, int valid)
 	       "    \"size\": %lld,\n"
 	       "    \"time\": %llu,\n"
 	       "    \"ignored\": %s,\n"
-	       "    \"notice\": \"%s\"\n"
-	       "  }\n"
-	       "}",
+	       "    \"notice\": \"%s\"",
 	       json_line++ ? "," : "",
 	       timestamp_str,
 	       localtime_str,
@@ -1538,70 +5393,793 @@ static void json_request(long long io_size, long long io_time, int valid)
 	       device_size,
 	       request,
 	       write_test ? "write" : "read",
-	       (long long)offset + woffset,
+	       (rw_flags & RWF_APPEND) ? -1 : (long long)offset + woffset,
 	       io_size,
 	       io_time,
 	       valid ? "false" : "true",
 	       notice ? notice : "");
+
+	if (cpu_stats)
+		json_cpu_usage(cpu, "    ");
+
+	if (perf_stats)
+		json_perf_usage(perf, "    ");
+
+	if (breakdown) {
+		int i;
+
+		printf(",\n    \"breakdown\": {");
+		for (i = 0; i < BREAKDOWN_PARTS; i++) {
+			printf("%s\n      \"%s\": ", i ? "," : "",
+			       breakdown_names[i]);
+			if (i == BREAKDOWN_FS || bd->matched)
+				printf("%lld", bd->time[i]);
+			else
+				printf("null");
+		}
+		printf("\n    }");
+	}
+
+	printf("\n  }\n}");
+}
+
+static void json_string(const char *str)
+{
+	putchar('"');
+	for (; *str; str++) {
+		if (*str == '"' || *str == '\\')
+			printf("\\%c", *str);
+		else if ((unsigned char)*str < 0x20)
+			printf("\\u%04x", *str);
+		else
+			putchar(*str);
+	}
+	putchar('"');
+}
+
+/* "<name>": { "count": ..., "mdev": ..., object is left open for extra fields */
+static void json_summary_line(const char *name, struct statistics *s)
+{
+	printf("\"%s\": { \"count\": %llu, \"min\": %llu, \"avg\": %.0f, "
+	       "\"max\": %llu, \"mdev\": %.0f",
+	       name, s->valid, s->min, s->avg, s->max, s->mdev);
+}
+
+static void json_statistics(struct statistics *s, struct statistics *bd,
+			    int summary)
+{
+	update_timestamp();
+
+	printf("%s{\n"
+	       "  \"timestamp\": %s,\n"
+	       "  \"localtime\": \"%s\",\n"
+	       "  \"target\": {\n"
+	       "    \"path\": \"%s\",\n"
+	       "    \"fstype\": \"%s\",\n"
+	       "    \"device\": \"%s\",\n"
+	       "    \"device_size\": %lld\n"
+	       "  },\n"
+	       "  \"stat\": {\n"
+	       "    \"count\": %llu,\n"
+	       "    \"size\": %llu,\n"
+	       "    \"time\": %.0f,\n"
+	       "    \"iops\": %f,\n"
+	       "    \"bps\": %.0f,\n"
+	       "    \"min\": %llu,\n"
+	       "    \"avg\": %.0f,\n"
+	       "    \"max\": %llu,\n"
+	       "    \"mdev\": %.0f\n"
+	       "  },\n"
+	       "  \"load\": {\n"
+	       "    \"count\": %llu,\n"
+	       "    \"failed\": %llu,\n"
+	       "    \"size\": %llu,\n"
+	       "    \"time\": %llu,\n"
+	       "    \"iops\": %f,\n"
+	       "    \"bps\": %.0f\n"
+	       "  }",
+	       json_line++ ? "," : "",
+	       timestamp_str,
+	       localtime_str,
+	       path,
+	       fstype,
+	       device,
+	       device_size,
+	       s->valid,
+	       s->size,
+	       s->sum,
+	       s->iops,
+	       s->speed,
+	       s->min,
+	       s->avg,
+	       s->max,
+	       s->mdev,
+	       s->count,
+	       s->failed,
+	       s->load_size,
+	       s->load_time,
+	       s->load_iops,
+	       s->load_speed);
+
+	if (cpu_stats)
+		json_cpu_usage(&s->cpu, "  ");
+
+	if (perf_stats)
+		json_perf_usage(&s->perf, "  ");
+
+	if (pressure)
+		json_pressure(&s->pressure, "  ");
+
+	if (throttle_threshold && summary)
+		printf(",\n  \"throttle\": {\n"
+		       "    \"threshold\": %lld,\n"
+		       "    \"count\": %llu,\n"
+		       "    \"fraction\": %f,\n"
+		       "    \"slow\": %lld,\n"
+		       "    \"time\": %.0f,\n"
+		       "    \"min\": %llu,\n"
+		       "    \"avg\": %.0f,\n"
+		       "    \"max\": %llu,\n"
+		       "    \"mdev\": %.0f\n"
+		       "  }",
+		       throttle_threshold, throttle_stats.valid,
+		       s->valid ? (double)throttle_stats.valid / s->valid : 0,
+		       throttle_slow, throttle_stats.sum, throttle_stats.min,
+		       throttle_stats.avg, throttle_stats.max,
+		       throttle_stats.mdev);
+
+	if (allocate && summary) {
+		printf(",\n  \"allocate\": {\n"
+		       "    \"mode\": \"%s\",\n    ", allocate_mode);
+		json_summary_line("allocating", &allocating_stats);
+		printf(" },\n    ");
+		json_summary_line("overwrite", &overwrite_stats);
+		printf(" }\n  }");
+	}
+
+	if (pair_request && summary) {
+		int i;
+
+		printf(",\n  \"%s\": {\n"
+		       "    \"engine\": \"%s\"", pair_key, pair_name);
+		for (i = 0; i < 2; i++) {
+			struct statistics *z = &pair_stats[i];
+
+			printf(",\n    ");
+			json_summary_line(i ? pair_key : pair_base, z);
+			if (cpu_stats)
+				printf(", \"cpu_time\": %lld, "
+				       "\"cpu_per_byte\": %f",
+				       z->cpu.time, z->size ?
+				       (double)z->cpu.time / z->size : 0);
+			printf(" }");
+		}
+		printf("\n  }");
+	}
+
+	if (nr_rwf_sets && summary) {
+		int i;
+
+		printf(",\n  \"rwf_matrix\": [");
+		for (i = 0; i < nr_rwf_sets; i++) {
+			struct statistics *r = &rwf_stats[i];
+
+			printf("%s\n    { \"flags\": \"%s\", \"count\": %llu, "
+			       "\"iops\": %f, \"min\": %llu, \"avg\": %.0f, "
+			       "\"max\": %llu, \"mdev\": %.0f }",
+			       i ? "," : "", rwf_string(rwf_sets[i]),
+			       r->valid, r->iops, r->min, r->avg, r->max,
+			       r->mdev);
+		}
+		printf("\n  ]");
+	}
+
+	if (sgio && summary) {
+		printf(",\n  ");
+		json_summary_line("sgio_duration", &sgio_stats);
+		printf(" }");
+	}
+
+	if (copy_mode && summary) {
+		printf(",\n  \"copy\": {\n"
+		       "    \"mode\": \"%s\",\n", copy_name);
+		if (copy_shared < 0)
+			printf("    \"shared\": null,\n"
+			       "    \"exclusive\": null\n  }");
+		else
+			printf("    \"shared\": %lld,\n"
+			       "    \"exclusive\": %lld\n  }",
+			       copy_shared, copy_exclusive);
+	}
+
+	if (zoned && summary) {
+		int i;
+
+		printf(",\n  \"zoned\": {\n"
+		       "    \"zones\": %d,\n"
+		       "    \"append\": %s",
+		       nr_zones, zone_append ? "true" : "false");
+		for (i = 0; i < ZONE_STATS; i++) {
+			printf(",\n    ");
+			json_summary_line(zone_names[i], &zone_stats[i]);
+			printf(" }");
+		}
+		printf("\n  }");
+	}
+
+	if (precondition && summary) {
+		int i;
+
+		printf(",\n  \"precondition\": {\n"
+		       "    \"passes\": %d,\n"
+		       "    \"round\": %lld,\n"
+		       "    \"rounds\": %d,\n"
+		       "    \"steady\": %s,\n"
+		       "    \"iops\": [",
+		       precondition_passes, precondition_round,
+		       precondition_rounds,
+		       precondition_steady ? "true" : "false");
+		for (i = 0; i < precondition_rounds; i++)
+			printf("%s%f", i ? ", " : " ", precondition_iops[i]);
+		printf(" ],\n    \"avg\": [");
+		for (i = 0; i < precondition_rounds; i++)
+			printf("%s%.0f", i ? ", " : " ", precondition_avg[i]);
+		printf(" ]\n  }");
+	}
+
+	if (cgroup_settings) {
+		int i;
+
+		printf(",\n  \"cgroup\": {");
+		for (i = 0; i < CGROUP_COUNTERS; i++) {
+			printf("%s\n    \"%s\": ", i ? "," : "",
+			       cgroup_names[i]);
+			if (cgroup_available[i])
+				printf("%lld", s->cgroup.stat[i]);
+			else
+				printf("null");
+		}
+		if (nr_cgroup_weights && !summary)
+			printf(",\n    \"weight\": %u",
+			       cgroup_weights[cgroup_weight]);
+		if (nr_cgroup_weights && summary) {
+			printf(",\n    \"weights\": [");
+			for (i = 0; i < nr_cgroup_weights; i++) {
+				struct statistics *w = &weight_stats[i];
+
+				printf("%s\n      { \"weight\": %u, "
+				       "\"count\": %llu, \"iops\": %f, "
+				       "\"min\": %llu, \"avg\": %.0f, "
+				       "\"max\": %llu, \"mdev\": %.0f }",
+				       i ? "," : "", cgroup_weights[i],
+				       w->valid, w->iops, w->min, w->avg,
+				       w->max, w->mdev);
+			}
+			printf("\n    ]");
+		}
+		printf("\n  }");
+	}
+
+	if (nr_streams && summary) {
+		int i;
+
+		printf(",\n  \"streams\": [");
+		for (i = 0; i < nr_streams; i++) {
+			struct statistics *sp = &stream_stats[i];
+
+			printf("%s\n    { \"offset\": %lld, \"size\": %lld, "
+			       "\"count\": %llu, \"failed\": %llu, "
+			       "\"iops\": %f, \"bps\": %.0f, "
+			       "\"min\": %llu, \"avg\": %.0f, "
+			       "\"max\": %llu, \"mdev\": %.0f }",
+			       i ? "," : "",
+			       (long long)(offset + i * stream_size),
+			       (long long)stream_size, sp->valid, sp->failed,
+			       sp->iops, sp->speed, sp->min, sp->avg,
+			       sp->max, sp->mdev);
+		}
+		printf("\n  ]");
+	}
+
+	if (arrival && summary) {
+		struct percentile r;
+		int i;
+
+		printf(",\n  \"arrival\": {\n"
+		       "    \"model\": \"%s\",\n"
+		       "    \"count\": %llu,\n"
+		       "    \"min\": %llu,\n"
+		       "    \"avg\": %.0f,\n"
+		       "    \"max\": %llu,\n"
+		       "    \"mdev\": %.0f",
+		       arrival_model, arrival_stats.valid, arrival_stats.min,
+		       arrival_stats.avg, arrival_stats.max,
+		       arrival_stats.mdev);
+		for (i = 0; i < nr_percentiles; i++) {
+			get_percentile(&arrival_stats, percentiles[i], &r);
+			printf(",\n    \"p%g\": %.0f", percentiles[i], r.value);
+		}
+		printf("\n  }");
+	}
+
+	if (nr_segments && summary) {
+		int i, j;
+
+		printf(",\n  \"schedule\": [");
+		for (i = 0; i < nr_segments; i++) {
+			struct statistics *seg = &segment_stats[i];
+			struct percentile r;
+
+			printf("%s\n    {\n"
+			       "      \"segment\": \"%s\",\n"
+			       "      \"from\": %f,\n"
+			       "      \"to\": %f,\n"
+			       "      \"duration\": %lld,\n"
+			       "      \"count\": %llu,\n"
+			       "      \"valid\": %llu,\n"
+			       "      \"failed\": %llu,\n"
+			       "      \"iops\": %f,\n"
+			       "      \"min\": %llu,\n"
+			       "      \"avg\": %.0f,\n"
+			       "      \"max\": %llu,\n"
+			       "      \"mdev\": %.0f",
+			       i ? "," : "", schedule[i].text,
+			       schedule[i].from, schedule[i].to,
+			       schedule[i].duration, seg->count, seg->valid,
+			       seg->failed, seg->load_iops, seg->min, seg->avg,
+			       seg->max, seg->mdev);
+			for (j = 0; j < nr_percentiles; j++) {
+				get_percentile(seg, percentiles[j], &r);
+				printf(",\n      \"p%g\": %.0f",
+				       percentiles[j], r.value);
+			}
+			printf("\n    }");
+		}
+		printf("\n  ]");
+	}
+
+	if (breakdown) {
+		int i;
+
+		printf(",\n  \"breakdown\": {");
+		for (i = 0; i < BREAKDOWN_PARTS; i++)
+			printf("%s\n    \"%s\": { \"count\": %llu, "
+			       "\"time\": %.0f, \"min\": %llu, "
+			       "\"avg\": %.0f, \"max\": %llu, "
+			       "\"mdev\": %.0f }",
+			       i ? "," : "", breakdown_names[i],
+			       bd[i].valid, bd[i].sum, bd[i].min,
+			       bd[i].avg, bd[i].max, bd[i].mdev);
+		printf("\n  }");
+		if (summary)
+			printf(",\n  \"breakdown_lost\": %lld", breakdown_lost);
+	}
+
+	if (nr_percentiles) {
+		struct percentile r;
+		int i;
+
+		printf(",\n  \"percentiles\": {\n");
+		for (i = 0; i < nr_percentiles; i++) {
+			get_percentile(s, percentiles[i], &r);
+			printf("    \"p%g\": { \"value\": %.0f, "
+			       "\"lower\": %.0f, \"upper\": %.0f }%s\n",
+			       percentiles[i], r.value, r.lower, r.upper,
+			       i + 1 < nr_percentiles ? "," : "");
+		}
+		printf("  }");
+	}
+
+	if (converge)
+		printf(",\n  \"converged\": %s", converged ? "true" : "false");
+
+	if (nr_slo) {
+		int i, first = 1;
+
+		printf(",\n  \"slo\": {\n"
+		       "    \"pass\": %s,\n"
+		       "    \"violated\": [",
+		       check_slo(s) ? "false" : "true");
+		for (i = 0; i < nr_slo; i++) {
+			if (slo_pass(s, &slo[i]))
+				continue;
+			printf("%s", first ? "" : ", ");
+			json_string(slo[i].text);
+			first = 0;
+		}
+		printf("]\n  }");
+	}
+
+	printf("\n}");
+}
+
+/*
+ * Binary trace: header followed by fixed-size records in native byte order.
+ */
+#define TRACE_MAGIC	"IOPINGTR"
+#define TRACE_VERSION	1
+
+#define TRACE_VALID	1
+#define TRACE_WRITE	2
+#define TRACE_FAILED	4
+
+struct trace_header {
+	char		magic[8];
+	unsigned int	version;
+	unsigned int	record_size;
+};
+
+struct trace_record {
+	long long	time;		/* since start, ns */
+	long long	offset;
+	long long	latency;	/* ns */
+	int		size;
+	int		flags;
+};
+
+static void open_trace(void)
+{
+	struct trace_header hdr;
+
+	trace_file = fopen(trace_path, "wb");
+	if (!trace_file)
+		err(2, "failed to open trace \"%s\"", trace_path);
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic));
+	hdr.version = TRACE_VERSION;
+	hdr.record_size = sizeof(struct trace_record);
+
+	if (fwrite(&hdr, sizeof(hdr), 1, trace_file) != 1)
+		err(2, "failed to write trace \"%s\"", trace_path);
+}
+
+static void trace_request(long long time, ssize_t io_size,
+			  long long io_time, int valid)
+{
+	struct trace_record rec = {
+		.time = time,
+		.offset = (long long)offset + woffset,
+		.latency = io_time,
+		.size = io_size,
+		.flags = (valid ? TRACE_VALID : 0) |
+			 (write_test ? TRACE_WRITE : 0) |
+			 (io_size <= 0 ? TRACE_FAILED : 0),
+	};
+
+	if (fwrite(&rec, sizeof(rec), 1, trace_file) != 1)
+		err(3, "failed to write trace \"%s\"", trace_path);
+}
+
+static void save_histogram(struct statistics *s, const char *path)
+{
+	FILE *file;
+	int i;
+
+	file = fopen(path, "w");
+	if (!file)
+		err(3, "failed to open histogram \"%s\"", path);
+
+	fprintf(file, "# ioping histogram: lower_ns upper_ns count\n");
+	for (i = 0; i < HIST_SIZE; i++)
+		if (s->hist[i])
+			fprintf(file, "%lld %lld %llu\n", hist_lower(i),
+				hist_upper(i), s->hist[i]);
+
+	if (fclose(file))
+		err(3, "failed to write histogram \"%s\"", path);
+}
+
+/* latency distribution as sorted distinct values with counts */
+struct sample {
+	long long		value;
+	unsigned long long	count;
+};
+
+struct sample_set {
+	const char		*path;
+	struct sample		*samples;
+	size_t			nr, alloc;
+	unsigned long long	total;
+};
+
+static void add_sample(struct sample_set *set, long long value,
+		       unsigned long long count)
+{
+	if (set->nr == set->alloc) {
+		set->alloc = set->alloc ? set->alloc * 2 : 1024;
+		set->samples = realloc(set->samples,
+				       set->alloc * sizeof(struct sample));
+		if (!set->samples)
+			err(2, NULL);
+	}
+	set->samples[set->nr].value = value;
+	set->samples[set->nr].count = count;
+	set->nr++;
+	set->total += count;
+}
+
+static int cmp_sample(const void *a, const void *b)
+{
+	const struct sample *x = a, *y = b;
+
+	return (x->value > y->value) - (x->value < y->value);
+}
+
+static void load_samples(struct sample_set *set, const char *path)
+{
+	struct trace_header hdr;
+	struct trace_record rec;
+	long long lower, upper;
+	unsigned long long count;
+	char line[256];
+	FILE *file;
+	size_t i, j;
+
+	memset(set, 0, sizeof(*set));
+	set->path = path;
+
+	file = fopen(path, "rb");
+	if (!file)
+		err(2, "failed to open \"%s\"", path);
+
+	if (fread(&hdr, sizeof(hdr), 1, file) == 1 &&
+	    !memcmp(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic))) {
+		if (hdr.version != TRACE_VERSION ||
+		    hdr.record_size != sizeof(rec))
+			errx(2, "unsupported trace format \"%s\"", path);
+		while (fread(&rec, sizeof(rec), 1, file) == 1)
+			if (rec.flags & TRACE_VALID)
+				add_sample(set, rec.latency, 1);
+	} else {
+		rewind(file);
+		while (fgets(line, sizeof(line), file)) {
+			if (line[0] == '#' || line[0] == '\n')
+				continue;
+			if (sscanf(line, "%lld %lld %llu",
+				   &lower, &upper, &count) != 3)
+				errx(2, "invalid histogram \"%s\": %s",
+				     path, line);
+			if (count)
+				add_sample(set, (lower + upper) / 2, count);
+		}
+	}
+	fclose(file);
+
+	if (!set->total)
+		errx(2, "no valid requests in \"%s\"", path);
+
+	qsort(set->samples, set->nr, sizeof(struct sample), cmp_sample);
+	for (i = 0, j = 1; j < set->nr; j++) {
+		if (set->samples[j].value == set->samples[i].value)
+			set->samples[i].count += set->samples[j].count;
+		else
+			set->samples[++i] = set->samples[j];
+	}
+	set->nr = i + 1;
+}
+
+/* value at given quantile */
+static long long sample_quantile(struct sample_set *set, double q)
+{
+	unsigned long long rank = ceil(q * set->total), sum = 0;
+	size_t i;
+
+	if (!rank)
+		rank = 1;
+	for (i = 0; i < set->nr; i++) {
+		sum += set->samples[i].count;
+		if (sum >= rank)
+			return set->samples[i].value;
+	}
+	return set->samples[set->nr - 1].value;
+}
+
+/* log-linear histogram of sample set, bootstrap resamples its buckets */
+static void bin_samples(struct statistics *s, struct sample_set *set)
+{
+	size_t i;
+
+	start_statistics(s, 0);
+	for (i = 0; i < set->nr; i++)
+		s->hist[hist_index(set->samples[i].value)] +=
+			set->samples[i].count;
+	s->valid = set->total;
+	s->min = set->samples[0].value;
+	s->max = set->samples[set->nr - 1].value;
+}
+
+static inline double random_double(void)
+{
+	return (random64() >> 11) * 0x1.0p-53;
+}
+
+static double random_normal(void)
+{
+	double u = random_double(), v = random_double();
+
+	return sqrt(-2 * log(1 - u)) * cos(2 * M_PI * v);
+}
+
+static unsigned long long random_binomial(unsigned long long n, double p)
+{
+	unsigned long long x = 0;
+	double pmf, cdf, u, r;
+
+	if (p <= 0)
+		return 0;
+	if (p >= 1)
+		return n;
+	if (n * (1 - p) < 30 && n * p >= 30)
+		return n - random_binomial(n, 1 - p);
+	if (n * p < 30) {
+		/* inversion, (1-p)^n does not underflow here */
+		pmf = pow(1 - p, n);
+		cdf = pmf;
+		u = random_double();
+		while (u > cdf && x < n) {
+			pmf *= (double)(n - x) / (x + 1) * p / (1 - p);
+			cdf += pmf;
+			x++;
+		}
+		return x;
+	}
+	r = round(n * p + sqrt(n * p * (1 - p)) * random_normal());
+	if (r < 0)
+		return 0;
+	if (r > n)
+		return n;
+	return r;
+}
+
+/* multinomial resample of histogram via conditional binomials */
+static void resample(struct statistics *s, struct statistics *r)
+{
+	unsigned long long left = s->valid, rest = s->valid;
+	int i;
+
+	for (i = 0; i < HIST_SIZE; i++) {
+		if (!left || !s->hist[i]) {
+			r->hist[i] = 0;
+			continue;
+		}
+		r->hist[i] = random_binomial(left, (double)s->hist[i] / rest);
+		left -= r->hist[i];
+		rest -= s->hist[i];
+	}
+	r->valid = s->valid;
+	r->min = s->min;
+	r->max = s->max;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	const double *x = a, *y = b;
+
+	return (*x > *y) - (*x < *y);
 }
 
-static void json_statistics(struct statistics *s)
-{
-	update_timestamp();
+#define COMPARE_ALPHA		0.05
+#define COMPARE_BOOTSTRAP	1000
+
+static const double compare_quantiles[] = { 0.5, 0.99 };
+
+/*
+ * Mann-Whitney U test with tie correction and bootstrap confidence
+ * intervals for change of median and 99th percentile.
+ * Returns 5 if result is significantly slower than baseline.
+ */
+static int compare_results(void)
+{
+	static struct statistics ha, hb, ra, rb;
+	struct sample_set a, b;
+	double ua = 0, ties = 0, mean, sigma, z, p_value, n;
+	double change[COMPARE_BOOTSTRAP];
+	unsigned long long rank = 0;
+	int nq = sizeof(compare_quantiles) / sizeof(compare_quantiles[0]);
+	int regression = 0, improvement = 0;
+	size_t i, j;
+	int q, k;
+
+	load_samples(&a, path);
+	load_samples(&b, compare_path);
+	random_init();
+
+	/* merge sorted sets and sum ranks of baseline with ties averaged */
+	for (i = 0, j = 0; i < a.nr || j < b.nr; ) {
+		unsigned long long na = 0, nb = 0, t;
+		long long v;
+
+		if (j >= b.nr || (i < a.nr &&
+				  a.samples[i].value <= b.samples[j].value))
+			v = a.samples[i].value;
+		else
+			v = b.samples[j].value;
+		if (i < a.nr && a.samples[i].value == v)
+			na = a.samples[i++].count;
+		if (j < b.nr && b.samples[j].value == v)
+			nb = b.samples[j++].count;
+		t = na + nb;
+		ua += na * (rank + (t + 1) / 2.0);
+		ties += (double)t * t * t - t;
+		rank += t;
+	}
+
+	n = (double)a.total + b.total;
+	ua -= (double)a.total * (a.total + 1) / 2;
+	mean = (double)a.total * b.total / 2;
+	sigma = sqrt((double)a.total * b.total / 12 *
+		     ((n + 1) - ties / (n * (n - 1))));
+	/* positive z: result is slower than baseline */
+	z = sigma ? ((double)a.total * b.total - ua - mean) / sigma : 0;
+	p_value = erfc(fabs(z) / M_SQRT2);
+
+	printf("--- %s vs %s ioping comparison ---\n", path, compare_path);
+	print_int(a.total);
+	printf(" vs ");
+	print_int(b.total);
+	printf(" requests\n");
+
+	bin_samples(&ha, &a);
+	bin_samples(&hb, &b);
+
+	for (q = 0; q < nq; q++) {
+		double quantile = compare_quantiles[q];
+		long long va = sample_quantile(&a, quantile);
+		long long vb = sample_quantile(&b, quantile);
+		double lo, hi;
+
+		for (k = 0; k < COMPARE_BOOTSTRAP; k++) {
+			double qa, qb;
+
+			resample(&ha, &ra);
+			resample(&hb, &rb);
+			qa = hist_rank(&ra, ceil(quantile * ra.valid));
+			qb = hist_rank(&rb, ceil(quantile * rb.valid));
+			change[k] = qa ? 100.0 * (qb - qa) / qa : 0;
+		}
+		qsort(change, COMPARE_BOOTSTRAP, sizeof(double), cmp_double);
+		lo = change[(int)(COMPARE_BOOTSTRAP * COMPARE_ALPHA / 2)];
+		hi = change[(int)(COMPARE_BOOTSTRAP * (1 - COMPARE_ALPHA / 2)) - 1];
+
+		printf("p%g = ", quantile * 100);
+		print_time(va);
+		printf(" -> ");
+		print_time(vb);
+		printf(", %+.1f %% (%g%% ci %+.1f .. %+.1f %%)",
+		       va ? 100.0 * (vb - va) / va : 0,
+		       100 * (1 - COMPARE_ALPHA), lo, hi);
+		if (lo > 0) {
+			printf(" slower");
+			regression = 1;
+		} else if (hi < 0) {
+			printf(" faster");
+			improvement = 1;
+		}
+		printf("\n");
+	}
+
+	printf("mann-whitney u = %.0f, z = %.2f, p = %.4f, "
+	       "P(result > baseline) = %.3f\n",
+	       (double)a.total * b.total - ua, z, p_value,
+	       ((double)a.total * b.total - ua) / ((double)a.total * b.total));
 
-	printf("%s{\n"
-	       "  \"timestamp\": %s,\n"
-	       "  \"localtime\": \"%s\",\n"
-	       "  \"target\": {\n"
-	       "    \"path\": \"%s\",\n"
-	       "    \"fstype\": \"%s\",\n"
-	       "    \"device\": \"%s\",\n"
-	       "    \"device_size\": %lld\n"
-	       "  },\n"
-	       "  \"stat\": {\n"
-	       "    \"count\": %llu,\n"
-	       "    \"size\": %llu,\n"
-	       "    \"time\": %.0f,\n"
-	       "    \"iops\": %f,\n"
-	       "    \"bps\": %.0f,\n"
-	       "    \"min\": %llu,\n"
-	       "    \"avg\": %.0f,\n"
-	       "    \"max\": %llu,\n"
-	       "    \"mdev\": %.0f\n"
-	       "  },\n"
-	       "  \"load\": {\n"
-	       "    \"count\": %llu,\n"
-	       "    \"failed\": %llu,\n"
-	       "    \"size\": %llu,\n"
-	       "    \"time\": %llu,\n"
-	       "    \"iops\": %f,\n"
-	       "    \"bps\": %.0f\n"
-	       "  }\n"
-	       "}",
-	       json_line++ ? "," : "",
-	       timestamp_str,
-	       localtime_str,
-	       path,
-	       fstype,
-	       device,
-	       device_size,
-	       s->valid,
-	       s->size,
-	       s->sum,
-	       s->iops,
-	       s->speed,
-	       s->min,
-	       s->avg,
-	       s->max,
-	       s->mdev,
-	       s->count,
-	       s->failed,
-	       s->load_size,
-	       s->load_time,
-	       s->load_iops,
-	       s->load_speed);
+	/* both shift test and percentile interval must agree */
+	if (p_value < COMPARE_ALPHA && z > 0 && regression) {
+		printf("significant regression\n");
+		return 5;
+	}
+	if (p_value < COMPARE_ALPHA && z < 0 && improvement)
+		printf("significant improvement\n");
+	else
+		printf("no significant change\n");
+
+	return 0;
 }
 
+/* ioping-test.c includes this file for unit tests and microbenchmarks */
+#ifndef IOPING_NO_MAIN
+
 int main (int argc, char **argv)
 {
 	ssize_t ret_size;
@@ -1610,12 +6188,25 @@ int main (int argc, char **argv)
 	int ret;
 
 	struct statistics part, total;
+	static struct statistics sofar;
+	struct cpu_usage cpu = { 0, 0, 0, 0 };
+	struct perf_usage perf;
+	struct breakdown bd;
+	int segment = 0, stat_segment = 0;
+	long long scheduled;
+
+	int i;
 
 	long long this_time;
 	long long time_now, time_next, period_deadline;
+	long long converge_next = 0;
+	int exit_code = 0;
 
 	parse_options(argc, argv);
 
+	if (compare)
+		return compare_results();
+
 	setvbuf(stdout, NULL, _IOFBF, BUFSIZ);
 
 	if (!size)
@@ -1624,6 +6215,33 @@ int main (int argc, char **argv)
 	if (size <= 0)
 		errx(1, "request size must be greater than zero");
 
+	if (nr_segments) {
+		if (custom_interval || rate_limit || speed_limit)
+			errx(1, "schedule conflicts with -i, -r and -l");
+		if (!deadline || deadline > schedule_length)
+			deadline = schedule_length;
+	}
+
+	if (nr_cgroup_weights && !period_time && !period_request)
+		errx(1, "io.weight rotation requires period, see -p and -P");
+
+	if (converge) {
+		if (!nr_percentiles)
+			parse_percentiles("50,99");
+		if (!deadline)
+			deadline = 60 * NSEC_PER_SEC;
+	}
+
+	/* dirty throttling needs buffered writes */
+	if (throttle_threshold) {
+		if (direct || sgio || zoned || copy_mode)
+			errx(1, "-throttle conflicts with -D, -sgio, -zoned "
+			     "and -copy");
+		if (!write_test)
+			write_test = 1;
+		cached = 1;
+	}
+
 	if (speed_limit) {
 		long long i = size * NSEC_PER_SEC / speed_limit;
 
@@ -1642,6 +6260,102 @@ int main (int argc, char **argv)
 			interval = i;
 	}
 
+	if (allocate && keep_file)
+		errx(1, "allocating writes conflict with -k");
+
+	/* preconditioning fills holes and unwritten extents */
+	if (allocate && precondition)
+		errx(1, "allocating writes conflict with -precondition");
+
+	if (copy_mode) {
+#ifndef HAVE_COPY
+		errx(1, "copy requests not supported by this platform");
+#endif
+		/* preconditioning would rewrite source after copy setup */
+		if (write_test || async || allocate || precondition)
+			errx(1, "copy requests conflict with -W, -G, -A, "
+			     "-allocate and -precondition");
+	}
+
+	if (zerocopy) {
+#ifndef HAVE_ZEROCOPY
+		errx(1, "zero-copy reads not supported by this platform");
+#endif
+		if (write_test || async || copy_mode)
+			errx(1, "zero-copy reads conflict with -W, -G, -A "
+			     "and -copy");
+	}
+
+	if (sgio) {
+#ifndef HAVE_SGIO
+		errx(1, "SG_IO not supported by this platform");
+#endif
+		if (write_read_test || async || copy_mode || zerocopy ||
+		    zoned)
+			errx(1, "SG_IO conflicts with -G, -A, -copy, "
+			     "-zerocopy and -zoned");
+	}
+
+	if (nr_rwf_sets) {
+		int all = 0;
+
+		if (write_read_test || copy_mode || zerocopy || sgio || zoned)
+			errx(1, "RWF matrix conflicts with -G, -copy, "
+			     "-zerocopy, -sgio and -zoned");
+		if (write_test && !cached)
+			errx(1, "RWF matrix for writes requires -C, "
+			     "add fdatasync into flag set for sync after write");
+		for (i = 0; i < nr_rwf_sets; i++) {
+			rwf_sets[i] |= rw_flags;
+			all |= rwf_sets[i];
+		}
+		if ((all & RWF_FDATASYNC) && !write_test)
+			errx(1, "fdatasync in RWF matrix requires write test");
+		if (all & RWF_APPEND)
+			errx(1, "RWF matrix compares sets at the same offset, "
+			     "append writes at end of file");
+	}
+
+	if ((rw_flags & RWF_APPEND) && !write_test)
+		errx(1, "RWF append requires write test");
+
+	if ((rw_flags & RWF_APPEND) && keep_file)
+		errx(1, "RWF append conflicts with -k, kept file would grow");
+
+	if (zoned) {
+#ifndef HAVE_ZONED
+		errx(1, "zoned devices not supported by this platform");
+#endif
+		/* zone writes, resets and finishes need O_RDWR descriptor */
+		if (write_test < 3)
+			errx(1, "zoned mode writes into device, "
+			     "think twice, then use -WWW");
+		if (!direct)
+			errx(1, "zoned mode requires direct I/O, see -D");
+		if (write_read_test || nr_streams || offset_pattern ||
+		    precondition)
+			errx(1, "zoned mode conflicts with -G, -streams, "
+			     "-pattern and -precondition");
+		if (zone_append && async)
+			errx(1, "zone append conflicts with -A");
+#ifndef HAVE_NVME_IOCTL
+		if (zone_append)
+			errx(1, "zone append not supported by this platform");
+#endif
+	}
+
+#ifndef HAVE_FALLOCATE
+	if (allocate == ALLOCATE_UNWRITTEN)
+		errx(1, "unwritten extents not supported by this platform");
+#endif
+
+	if (arrival) {
+		if (burst)
+			errx(1, "arrival model conflicts with -b");
+		if (!interval && !nr_segments)
+			errx(1, "arrival model requires rate, see -i and -r");
+	}
+
 #ifdef MAX_RW_COUNT
 	if (size > MAX_RW_COUNT)
 		warnx("this platform supports requests %u bytes at most",
@@ -1670,7 +6384,7 @@ int main (int argc, char **argv)
 
 	if (async) {
 		aio_setup();
-	} else if (rw_flags) {
+	} else if (rw_flags || nr_rwf_sets) {
 #ifdef HAVE_LINUX_PREADV2
 		make_pread = do_preadv2;
 		make_pwrite = do_pwritev2;
@@ -1699,12 +6413,34 @@ int main (int argc, char **argv)
 		errx(1, "data sync I/O not supported by this platform");
 #endif
 
+#ifndef HAVE_THREAD_CPU_USAGE
+	if (cpu_stats)
+		errx(1, "cpu accounting not supported by this platform");
+#endif
+
 	if (stat(path, &st))
 		err(2, "stat \"%s\" failed", path);
 
-	if (!S_ISDIR(st.st_mode) && write_test && write_test < 3)
+	if (!S_ISDIR(st.st_mode) && (write_test || precondition) &&
+	    write_test < 3)
 		errx(2, "think twice, then use -WWW to shred this target");
 
+	if (allocate && !S_ISDIR(st.st_mode))
+		errx(2, "allocating writes require directory target");
+
+	if (copy_mode && !S_ISDIR(st.st_mode))
+		errx(2, "copy requests require directory target");
+
+	if (sgio && !S_ISBLK(st.st_mode) && !S_ISCHR(st.st_mode))
+		errx(2, "SG_IO requires block or sg device");
+
+	if (sgio && S_ISBLK(st.st_mode) && !direct)
+		errx(1, "SG_IO comparison requires direct I/O, see -D");
+
+	/* sg character device has no page cache */
+	if (sgio && S_ISCHR(st.st_mode))
+		cached = 1;
+
 	if (S_ISDIR(st.st_mode) || S_ISREG(st.st_mode)) {
 		if (S_ISDIR(st.st_mode))
 			st.st_size = offset + temp_wsize;
@@ -1724,6 +6460,9 @@ int main (int argc, char **argv)
 			fstype = "block";
 			device = "device";
 		}
+
+		if (sgio)
+			sgio_setup(&st);
 	} else {
 		errx(2, "unsupported destination: \"%s\"", path);
 	}
@@ -1737,11 +6476,27 @@ int main (int argc, char **argv)
 	if (size > wsize)
 		errx(2, "request size is too big for this target");
 
+	if (nr_streams && offset_pattern)
+		errx(1, "streams conflict with offset pattern");
+
+	if (zoned) {
+		if (!S_ISBLK(st.st_mode))
+			errx(2, "zoned mode requires block device");
+		zone_setup();
+	}
+
+	random_init();
+	offset_setup();
+	if (zerocopy)
+		zerocopy_setup();
+	stream_size = stream_blocks * size;
+
 	ret = posix_memalign(&buf, 0x1000, size);
 	if (ret)
 		errx(2, "buffer allocation failed");
 
-	random_init();
+	if (arrival)
+		arrival_setup();
 
 	random_memory(buf, size);
 
@@ -1749,28 +6504,25 @@ int main (int argc, char **argv)
 		target_fd = open_file(path, "ioping.tmp");
 		if (target_fd < 0)
 			err(2, "failed to create temporary file at \"%s\"", path);
+		if (keep_file && prepared_reuse(buf))
+			goto skip_preparation;
+		if (allocate) {
+			allocate_setup();
+			goto skip_preparation;
+		}
+		prepare_range(buf, offset, offset + wsize);
 		if (keep_file) {
-			if (fstat(target_fd, &st))
-				err(2, "fstat at \"%s\" failed", path);
-			if (st.st_size >= offset + wsize)
-#ifndef __MINGW32__
-			    if (st.st_blocks >= (st.st_size + 511) / 512)
-#endif
-				goto skip_preparation;
-		}
-		for (woffset = 0 ; woffset < wsize ; woffset += ret_size) {
-			ret_size = size;
-			if (woffset + ret_size > wsize)
-				ret_size = wsize - woffset;
-			if (woffset)
-				random_memory(buf, ret_size);
-			ret_size = pwrite(target_fd, buf, ret_size, offset + woffset);
-			if (ret_size <= 0)
-				err(2, "preparation write failed");
+			if (fsync(target_fd))
+				err(2, "fsync failed");
+			prepared.start = offset;
+			prepared.end = offset + wsize;
+			prepared_store();
 		}
 skip_preparation:
 		if (fsync(target_fd))
 			err(2, "fsync failed");
+		if (copy_mode)
+			copy_setup(path, buf);
 	} else if (S_ISREG(st.st_mode)) {
 		target_fd = open_file(path, NULL);
 		if (target_fd < 0)
@@ -1801,12 +6553,87 @@ skip_preparation:
 
 	set_signal();
 
+	if (precondition) {
+		run_precondition();
+		/* precondition rewrote sampled blocks of kept file */
+		if (prepared.end)
+			prepared_store();
+	}
+
+	if (nr_rwf_sets || (rw_flags & ~(RWF_NOWAIT | RWF_HIPRI)))
+		rwf_probe();
+
+	if (trace_path)
+		open_trace();
+
+	memset(&perf, 0, sizeof(perf));
+	if (perf_stats)
+		perf_setup();
+
+	if (cgroup_settings) {
+		struct stat fst;
+
+		if (fstat(target_fd, &fst))
+			err(2, "fstat at \"%s\" failed", path);
+		cgroup_setup(S_ISBLK(fst.st_mode) ? fst.st_rdev : fst.st_dev);
+	}
+
+	if (pressure)
+		pressure_setup();
+
+	memset(&bd, 0, sizeof(bd));
+	if (breakdown) {
+		struct stat fst;
+
+		if (fstat(target_fd, &fst))
+			err(2, "fstat at \"%s\" failed", path);
+		breakdown_setup(S_ISBLK(fst.st_mode) ? fst.st_rdev :
+				fst.st_dev, S_ISREG(fst.st_mode));
+	}
+
 	woffset = 0;
 
 	time_now = now();
 
 	start_statistics(&part, time_now);
 	start_statistics(&total, time_now);
+	for (i = 0; i < BREAKDOWN_PARTS; i++) {
+		start_statistics(&breakdown_part[i], time_now);
+		start_statistics(&breakdown_total[i], time_now);
+	}
+	start_statistics(&throttle_stats, time_now);
+	start_statistics(&allocating_stats, time_now);
+	start_statistics(&overwrite_stats, time_now);
+	for (i = 0; i < ZONE_STATS; i++)
+		start_statistics(&zone_stats[i], time_now);
+	for (i = 0; i < 2; i++)
+		start_statistics(&pair_stats[i], time_now);
+	start_statistics(&sgio_stats, time_now);
+	for (i = 0; i < nr_rwf_sets; i++)
+		start_statistics(&rwf_stats[i], time_now);
+	start_statistics(&arrival_stats, time_now);
+	if (nr_streams) {
+		stream_stats = calloc(nr_streams, sizeof(*stream_stats));
+		if (!stream_stats)
+			err(2, NULL);
+		for (i = 0; i < nr_streams; i++)
+			start_statistics(&stream_stats[i], time_now);
+	}
+	if (nr_segments) {
+		segment_stats = calloc(nr_segments, sizeof(*segment_stats));
+		if (!segment_stats)
+			err(2, NULL);
+		for (i = 0; i < nr_segments; i++)
+			start_statistics(&segment_stats[i],
+					 time_now + schedule[i].start);
+	}
+	if (nr_cgroup_weights) {
+		weight_stats = calloc(nr_cgroup_weights, sizeof(*weight_stats));
+		if (!weight_stats)
+			err(2, NULL);
+		for (i = 0; i < nr_cgroup_weights; i++)
+			start_statistics(&weight_stats[i], time_now);
+	}
 
 	if (json)
 		printf("[");
@@ -1820,9 +6647,20 @@ skip_preparation:
 
 	while (!exiting) {
 		request++;
-
-		if (randomize)
-			woffset = random64() % (wsize / size) * size;
+		scheduled = time_next;
+
+		if (zoned)
+			woffset = zone_next() - offset;
+		else if (nr_rwf_sets ? !((request - 1) % nr_rwf_sets) :
+			 !pair_request || (request & 1))
+			woffset = next_offset() * size;
+
+		/* flag sets in turn, first set rotates with each offset */
+		if (nr_rwf_sets) {
+			rwf_set = (request - 1 + (request - 1) / nr_rwf_sets) %
+				  nr_rwf_sets;
+			rw_flags = rwf_sets[rwf_set] & ~RWF_FDATASYNC;
+		}
 
 #ifdef HAVE_POSIX_FADVICE
 		if (!cached) {
@@ -1839,9 +6677,33 @@ skip_preparation:
 			make_request = write_test ? make_pwrite : make_pread;
 		}
 
+		/* pairs of requests, alternative engine goes first in odd pairs */
+		if (pair_request) {
+			pair_engine = (request & 1) == (((request + 1) / 2) & 1);
+			make_request = pair_engine ? pair_request :
+				       write_test ? make_pwrite : make_pread;
+		}
+
 		if (write_test)
 			random_memory(buf, size);
 
+		if (breakdown)
+			breakdown_start(target_fd, offset + woffset, size);
+
+		if (throttle_threshold && write_test)
+			throttle_before = dirty_throttled();
+
+		if (allocate && write_test)
+			allocating = allocate_request(woffset);
+
+		if (cpu_stats)
+			cpu_usage_start();
+
+		if (perf_stats)
+			perf_usage_start();
+
+		PROBE3(request_start, request, offset + woffset, size);
+
 		this_time = now();
 
 		ret_size = make_request(target_fd, buf, size, offset + woffset);
@@ -1858,30 +6720,131 @@ skip_preparation:
 			else if (ret_size > size)
 				errx(3, "request returned more than expected: %zu", ret_size);
 
-			if (write_test && !cached)
+			/* SG_IO WRITE(16) already carries FUA */
+			if (write_test && !(sgio && pair_engine) &&
+			    (!cached || (nr_rwf_sets &&
+			     (rwf_sets[rwf_set] & RWF_FDATASYNC))))
 				sync_file(target_fd);
 		}
 
 		time_now = now();
 
+		if (perf_stats)
+			perf_usage_finish(&perf);
+
+		if (cpu_stats)
+			cpu_usage_finish(&cpu);
+
 		if (!burst || ++burst_request == burst) {
 		    burst_request = 0;
-		    time_next += interval;
+		    if (nr_segments)
+			interval = schedule_interval(time_next - total.start,
+						     &segment) * (burst ? burst : 1);
+		    time_next += arrival ? arrival_interval(interval) : interval;
 		}
 
-		if ((time_now - time_next) > 0)
+		/* arrivals do not wait for slow requests */
+		if (!arrival && (time_now - time_next) > 0)
 			time_next = time_now;
 
 		this_time = time_now - this_time;
 
+		if (breakdown)
+			breakdown_finish(time_now - this_time, this_time, &bd);
+
 		timestamp_uptodate = 0;
 
 		valid = add_statistics(&part, ret_size, this_time);
 
+		PROBE5(request_done, request, offset + woffset, size,
+		       this_time, ret_size);
+
+		if (cpu_stats)
+			add_cpu_usage(&part, &cpu);
+
+		if (perf_stats)
+			add_perf_usage(&part, &perf);
+
+		if (breakdown && valid)
+			add_breakdown(&bd);
+
+		if (throttle_threshold && write_test && valid)
+			add_throttle(this_time);
+
+		if (allocate && write_test && valid)
+			add_allocate(this_time);
+
+		if (pair_request) {
+			struct statistics *z = &pair_stats[pair_engine];
+
+			z->count++;
+			if (valid) {
+				add_valid(z, this_time);
+				add_cpu_usage(z, &cpu);
+			}
+		}
+
+		if (nr_rwf_sets) {
+			struct statistics *r = &rwf_stats[rwf_set];
+
+			r->count++;
+			if (valid)
+				add_valid(r, this_time);
+		}
+
+		if (sgio_duration >= 0) {
+			sgio_stats.count++;
+			if (valid)
+				add_valid(&sgio_stats, sgio_duration);
+			sgio_duration = -1;
+		}
+
+		if (zoned && zone_cond >= 0) {
+			zone_stats[zone_cond].count++;
+			if (valid)
+				add_valid(&zone_stats[zone_cond], this_time);
+		}
+
+		if (nr_streams) {
+			struct statistics *sp = &stream_stats[offset_stream];
+
+			sp->count++;
+			if (valid)
+				add_valid(sp, this_time);
+			else if (ret_size <= 0)
+				sp->failed++;
+		}
+
+		if (arrival) {
+			long long delay = time_now - this_time - scheduled;
+
+			arrival_stats.count++;
+			add_valid(&arrival_stats, delay > 0 ? delay : 0);
+		}
+
+		if (nr_segments) {
+			struct statistics *seg;
+			long long issue = time_now - this_time - total.start;
+
+			while (stat_segment + 1 < nr_segments &&
+			       issue >= schedule[stat_segment + 1].start)
+				stat_segment++;
+			seg = &segment_stats[stat_segment];
+			seg->count++;
+			if (valid)
+				add_valid(seg, this_time);
+			else if (ret_size <= 0)
+				seg->failed++;
+		}
+
+		if (trace_file)
+			trace_request(time_now - this_time - total.start,
+				      ret_size, this_time, valid);
+
 		if (quiet) {
 			/* silence */
 		} else if (json) {
-			json_request(ret_size, this_time, valid);
+			json_request(ret_size, this_time, valid, &cpu, &perf, &bd);
 		} else {
 			if (time_info) {
 				update_timestamp();
@@ -1895,6 +6858,12 @@ skip_preparation:
 			print_time(this_time);
 			if (notice)
 			    printf(" (%s)", notice);
+			if (cpu_stats && notice && strstr(notice, "slow")) {
+			    printf(" cpu=");
+			    print_time(cpu.time);
+			    printf(" switches=%lld/%lld migrations=%lld",
+				   cpu.vcsw, cpu.ivcsw, cpu.migrations);
+			}
 			if (burst && !burst_request)
 			    printf("\n");
 			printf("\n");
@@ -1903,22 +6872,39 @@ skip_preparation:
 		if ((period_request && (part.valid >= period_request)) ||
 		    (period_time && (time_next >= period_deadline))) {
 			finish_statistics(&part, time_now);
+			for (i = 0; i < BREAKDOWN_PARTS; i++)
+				finish_statistics(&breakdown_part[i], time_now);
+			if (pressure)
+				pressure_update(&part.pressure);
+			if (cgroup_settings)
+				cgroup_update(&part.cgroup);
+			PROBE5(period, part.count, part.valid,
+			       (long long)part.sum, part.min, part.max);
+			if (nr_slo && check_slo(&part)) {
+				slo_period_failed = 1;
+				if (!json)
+					warn_slo(&part);
+			}
 			if (json)
-				json_statistics(&part);
+				json_statistics(&part, breakdown_part, 0);
 			else
 				dump_statistics(&part);
 			fflush(stdout);
 			merge_statistics(&total, &part);
+			if (nr_cgroup_weights) {
+				merge_statistics(&weight_stats[cgroup_weight],
+						 &part);
+				cgroup_next_weight();
+			}
 			start_statistics(&part, time_now);
+			for (i = 0; i < BREAKDOWN_PARTS; i++) {
+				merge_statistics(&breakdown_total[i],
+						 &breakdown_part[i]);
+				start_statistics(&breakdown_part[i], time_now);
+			}
 			period_deadline = time_now + period_time;
 		}
 
-		if (!randomize) {
-			woffset += size;
-			if (woffset + size > wsize)
-				woffset = 0;
-		}
-
 		if (exiting)
 			break;
 
@@ -1928,6 +6914,16 @@ skip_preparation:
 		if (deadline && time_next >= deadline)
 			break;
 
+		if (converge && time_now >= converge_next) {
+			converge_next = time_now + CONVERGE_CHECK;
+			sofar = total;
+			merge_statistics(&sofar, &part);
+			if (check_converge(&sofar)) {
+				converged = 1;
+				break;
+			}
+		}
+
 		if ((time_next - time_now) > 0) {
 			long long delta = time_next - time_now;
 
@@ -1943,22 +6939,100 @@ skip_preparation:
 
 	time_now = now();
 	finish_statistics(&part, time_now);
+	if (pressure)
+		pressure_update(&part.pressure);
+	if (cgroup_settings)
+		cgroup_update(&part.cgroup);
 	merge_statistics(&total, &part);
+	if (nr_cgroup_weights)
+		merge_statistics(&weight_stats[cgroup_weight], &part);
+	for (i = 0; i < nr_cgroup_weights; i++)
+		finish_statistics(&weight_stats[i], time_now);
 	finish_statistics(&total, time_now);
+	for (i = 0; i < BREAKDOWN_PARTS; i++) {
+		merge_statistics(&breakdown_total[i], &breakdown_part[i]);
+		finish_statistics(&breakdown_total[i], time_now);
+	}
+	finish_statistics(&throttle_stats, time_now);
+	finish_statistics(&allocating_stats, time_now);
+	finish_statistics(&overwrite_stats, time_now);
+	for (i = 0; i < ZONE_STATS; i++)
+		finish_statistics(&zone_stats[i], time_now);
+	for (i = 0; i < 2; i++)
+		finish_statistics(&pair_stats[i], time_now);
+	finish_statistics(&sgio_stats, time_now);
+	for (i = 0; i < nr_rwf_sets; i++)
+		finish_statistics(&rwf_stats[i], time_now);
+	finish_statistics(&arrival_stats, time_now);
+	for (i = 0; i < nr_streams; i++)
+		finish_statistics(&stream_stats[i], time_now);
+	for (i = 0; i < nr_segments; i++) {
+		struct statistics *seg = &segment_stats[i];
+		long long end = seg->start + schedule[i].duration;
+
+		if (end > time_now)
+			end = time_now > seg->start ? time_now : seg->start;
+		finish_statistics(seg, end);
+	}
+
+	if (copy_mode)
+		copy_extents();
+
+	/* writes changed sampled blocks of kept file */
+	if (write_test && prepared.end)
+		prepared_store();
+
+	if (trace_file && fclose(trace_file))
+		err(3, "failed to write trace \"%s\"", trace_path);
+
+	if (histogram_path)
+		save_histogram(&total, histogram_path);
+
+	if (histogram_path && throttle_threshold) {
+		char name[PATH_MAX];
+
+		snprintf(name, sizeof(name), "%s.throttled", histogram_path);
+		save_histogram(&throttle_stats, name);
+	}
+
+	if (histogram_path && allocate) {
+		char name[PATH_MAX];
+
+		snprintf(name, sizeof(name), "%s.allocating", histogram_path);
+		save_histogram(&allocating_stats, name);
+		snprintf(name, sizeof(name), "%s.overwrite", histogram_path);
+		save_histogram(&overwrite_stats, name);
+	}
+
+	if (histogram_path && breakdown) {
+		for (i = 0; i < BREAKDOWN_PARTS; i++) {
+			char name[PATH_MAX];
+
+			snprintf(name, sizeof(name), "%s.%s",
+				 histogram_path, breakdown_names[i]);
+			save_histogram(&breakdown_total[i], name);
+		}
+	}
+
+	/* distinct exit codes for health checks */
+	if (nr_slo && check_slo(&total))
+		exit_code = 6;
+	else if (slo_period_failed)
+		exit_code = 7;
 
 	if (json) {
-		json_statistics(&total);
+		json_statistics(&total, breakdown_total, 1);
 		printf("]\n");
-		return 0;
+		return exit_code;
 	}
 
 	if (batch_mode) {
 		dump_statistics(&total);
-		return 0;
+		return exit_code;
 	}
 
 	if (quiet && (period_time || period_request))
-		return 0;
+		return exit_code;
 
 	printf("\n--- %s (%s %s ", path, fstype, device);
 	print_size(device_size);
@@ -1968,7 +7042,7 @@ skip_preparation:
 	print_time(total.sum);
 	printf(", ");
 	print_size(total.size);
-	printf("%s, ", write_read_test ? "" :
+	printf("%s, ", write_read_test ? "" : copy_mode ? " copied" :
 			write_test ? " written" : " read");
 	print_int(total.iops);
 	printf(" iops, ");
@@ -2005,5 +7079,280 @@ skip_preparation:
 	print_time(total.mdev);
 	printf("\n");
 
-	return 0;
+	if (cpu_stats && total.count) {
+		printf("cpu ");
+		print_time(total.cpu.time / total.count);
+		printf(" per request, ");
+		print_int(total.cpu.vcsw);
+		printf(" voluntary and ");
+		print_int(total.cpu.ivcsw);
+		printf(" involuntary switches, ");
+		print_int(total.cpu.migrations);
+		printf(" migrations\n");
+	}
+
+	if (perf_stats && total.count) {
+		int i, first = 1;
+
+		printf("perf");
+		for (i = 0; i < PERF_EVENTS; i++) {
+			double avg = (double)total.perf.count[i] / total.count;
+
+			if (!perf_available[i])
+				continue;
+			printf("%s ", first ? "" : ",");
+			if (avg < 1000)
+				printf("%.1f", avg);
+			else
+				print_int(avg);
+			printf(" %s", perf_names[i]);
+			first = 0;
+		}
+		printf(" per request\n");
+	}
+
+	if (throttle_threshold) {
+		printf("throttled ");
+		print_int(throttle_stats.valid);
+		printf(" of ");
+		print_int(total.valid);
+		printf(" (%.1f%%), min/avg/max/mdev = ", total.valid ?
+		       100.0 * throttle_stats.valid / total.valid : 0.0);
+		print_time(throttle_stats.min);
+		printf(" / ");
+		print_time(throttle_stats.avg);
+		printf(" / ");
+		print_time(throttle_stats.max);
+		printf(" / ");
+		print_time(throttle_stats.mdev);
+		printf(", ");
+		print_int(throttle_slow);
+		printf(" slow below freerun\n");
+	}
+
+	if (allocate) {
+		print_summary_line("allocating", &allocating_stats);
+		printf("\n");
+		print_summary_line("overwrite", &overwrite_stats);
+		printf("\n");
+	}
+
+	for (i = 0; pair_request && i < 2; i++) {
+		struct statistics *z = &pair_stats[i];
+		char name[16];
+
+		snprintf(name, sizeof(name), "%-8s", i ? pair_name : pair_base);
+		print_summary_line(name, z);
+		if (cpu_stats) {
+			printf(", cpu ");
+			print_time(z->size ? (double)z->cpu.time * (1 << 20) /
+				   z->size : 0);
+			printf(" per MiB");
+		}
+		printf("\n");
+	}
+
+	if (nr_rwf_sets)
+		rwf_summary();
+
+	if (sgio) {
+		print_summary_line("sg_io duration", &sgio_stats);
+		printf("\n");
+	}
+
+	if (copy_mode) {
+		printf("%s destination ", copy_name);
+		if (copy_shared < 0) {
+			printf("extents unknown\n");
+		} else {
+			print_size(copy_shared);
+			printf(" shared, ");
+			print_size(copy_exclusive);
+			printf(" exclusive\n");
+		}
+	}
+
+	for (i = 0; zoned && i < ZONE_STATS; i++) {
+		char name[32];
+
+		if (!zone_stats[i].count)
+			continue;
+		snprintf(name, sizeof(name), "zone %s%s:",
+			 i < ZONE_OPEN ? "write " : "", zone_names[i]);
+		print_summary_line(name, &zone_stats[i]);
+		printf("\n");
+	}
+
+	if (precondition) {
+		printf("precondition %d passes and %d rounds of ",
+		       precondition_passes, precondition_rounds);
+		print_time(precondition_round);
+		printf(", %s ", precondition_steady ?
+		       "steady state" : "not steady");
+		print_int(precondition_mean(precondition_iops));
+		printf(" iops, avg ");
+		print_time(precondition_mean(precondition_avg));
+		printf("\n");
+	}
+
+	if (cgroup_settings) {
+		printf("cgroup");
+		for (i = 0; i < CGROUP_COUNTERS; i++) {
+			if (!cgroup_available[i])
+				continue;
+			printf("%s %s ", i ? "," : "", cgroup_names[i]);
+			if (i == CGROUP_RBYTES || i == CGROUP_WBYTES)
+				print_size(total.cgroup.stat[i]);
+			else if (i >= CGROUP_COST_WAIT)
+				print_time(total.cgroup.stat[i]);
+			else
+				print_int(total.cgroup.stat[i]);
+		}
+		printf("\n");
+	}
+
+	for (i = 0; i < nr_streams; i++) {
+		struct statistics *sp = &stream_stats[i];
+
+		printf("stream %d at ", i);
+		print_size(offset + i * stream_size);
+		printf(": ");
+		print_int(sp->valid);
+		printf(" requests, ");
+		print_int(sp->iops);
+		printf(" iops, ");
+		print_size(sp->speed);
+		printf("/s, min/avg/max/mdev = ");
+		print_time(sp->min);
+		printf(" / ");
+		print_time(sp->avg);
+		printf(" / ");
+		print_time(sp->max);
+		printf(" / ");
+		print_time(sp->mdev);
+		printf("\n");
+	}
+
+	if (arrival) {
+		printf("arrival %s: issue delay min/avg/max/mdev = ",
+		       arrival_model);
+		print_time(arrival_stats.min);
+		printf(" / ");
+		print_time(arrival_stats.avg);
+		printf(" / ");
+		print_time(arrival_stats.max);
+		printf(" / ");
+		print_time(arrival_stats.mdev);
+		if (nr_percentiles) {
+			printf(", ");
+			print_percentiles(&arrival_stats);
+		}
+		printf("\n");
+	}
+
+	for (i = 0; i < nr_segments; i++) {
+		struct statistics *seg = &segment_stats[i];
+
+		printf("segment %s: ", schedule[i].text);
+		print_int(seg->valid);
+		printf(" requests, ");
+		print_int(seg->load_iops);
+		printf(" iops, min/avg/max/mdev = ");
+		print_time(seg->min);
+		printf(" / ");
+		print_time(seg->avg);
+		printf(" / ");
+		print_time(seg->max);
+		printf(" / ");
+		print_time(seg->mdev);
+		if (nr_percentiles) {
+			printf(", ");
+			print_percentiles(seg);
+		}
+		printf("\n");
+	}
+
+	for (i = 0; i < nr_cgroup_weights; i++) {
+		struct statistics *w = &weight_stats[i];
+
+		printf("io.weight %u: ", cgroup_weights[i]);
+		print_int(w->valid);
+		printf(" requests, ");
+		print_int(w->iops);
+		printf(" iops, min/avg/max/mdev = ");
+		print_time(w->min);
+		printf(" / ");
+		print_time(w->avg);
+		printf(" / ");
+		print_time(w->max);
+		printf(" / ");
+		print_time(w->mdev);
+		printf("\n");
+	}
+
+	if (pressure) {
+		struct pressure *p = &total.pressure;
+
+		printf("pressure");
+		for (i = 0; i < STALL_COUNTERS; i += 2) {
+			if (!stall_available[i])
+				continue;
+			printf(" %s ", i == STALL_IO_SOME ? "io" :
+			       i == STALL_MEMORY_SOME ? "memory" : "cgroup io");
+			print_time(p->stall[i]);
+			printf(" / ");
+			print_time(p->stall[i + 1]);
+			printf(",");
+		}
+		printf(" dirty ");
+		print_size(p->dirty);
+		printf(", writeback ");
+		print_size(p->writeback);
+		printf("\nvmstat");
+		for (i = 0; i < VMSTAT_COUNTERS; i++) {
+			printf("%s %s ", i ? "," : "", vmstat_names[i]);
+			print_int(p->vmstat[i]);
+		}
+		printf("\n");
+	}
+
+	if (breakdown) {
+		for (i = 0; i < BREAKDOWN_PARTS; i++) {
+			struct statistics *b = &breakdown_total[i];
+
+			printf("%s min/avg/max/mdev = ", breakdown_names[i]);
+			print_time(b->min);
+			printf(" / ");
+			print_time(b->avg);
+			printf(" / ");
+			print_time(b->max);
+			printf(" / ");
+			print_time(b->mdev);
+			if (i != BREAKDOWN_FS) {
+				printf(" in ");
+				print_int(b->valid);
+				printf(" requests");
+			}
+			printf("\n");
+		}
+		if (breakdown_lost) {
+			printf("breakdown lost ");
+			print_int(breakdown_lost);
+			printf(" block events, some requests are unmatched\n");
+		}
+	}
+
+	if (nr_percentiles) {
+		print_percentiles(&total);
+		if (converge)
+			printf(", %s", converged ? "converged" : "not converged");
+		printf("\n");
+	}
+
+	if (nr_slo)
+		print_slo(&total);
+
+	return exit_code;
 }
+
+#endif /* IOPING_NO_MAIN */